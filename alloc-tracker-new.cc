@@ -0,0 +1,43 @@
+// alloc-tracker-new.cc
+//
+// This file replaces the global operator new and delete so that
+// allocations can be attributed to the counters in alloc-tracker.h.
+// When tracking is off the only overhead is two thread-local
+// pointer tests per allocation.
+//
+// It is linked into the programs but deliberately kept out of
+// libspfeatures.a, so that a program embedding the library keeps its
+// own operator new (and whatever allocator that uses).
+
+#include <cstdlib>
+#include <new>
+
+#include "alloc-tracker.h"
+
+#if __cplusplus >= 201103L
+#define NEW_THROW_SPEC
+#define DELETE_THROW_SPEC noexcept
+#else
+#define NEW_THROW_SPEC throw(std::bad_alloc)
+#define DELETE_THROW_SPEC throw()
+#endif
+
+void* operator new(size_t n) NEW_THROW_SPEC {
+  alloc_tracker::count(n);
+  void* p = malloc(n > 0 ? n : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t n) NEW_THROW_SPEC {
+  alloc_tracker::count(n);
+  void* p = malloc(n > 0 ? n : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) DELETE_THROW_SPEC { free(p); }
+
+void operator delete[](void* p) DELETE_THROW_SPEC { free(p); }
@@ -0,0 +1,17 @@
+// alloc-tracker.cc
+//
+// This file defines the alloc_tracker state declared in
+// alloc-tracker.h.  It is part of libspfeatures.a, and doesn't replace
+// operator new and delete: on its own, only the tree_node cache's
+// allocations are counted.  The programs also link alloc-tracker-new.o,
+// which counts the allocations made through operator new.
+
+#include <cstddef>
+
+#include "alloc-tracker.h"
+
+namespace alloc_tracker {
+  bool enabled = false;
+  __thread alloc_counter* phase = NULL;
+  __thread alloc_counter* featureclass = NULL;
+}  // namespace alloc_tracker
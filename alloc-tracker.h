@@ -0,0 +1,75 @@
+// alloc-tracker.h -- attribute heap allocations to phases and feature classes
+//
+// alloc-tracker-new.cc replaces the global operator new and delete in
+// the programs (but not in libspfeatures.a).  When tracking is on,
+// every allocation made by a thread is added to the
+// alloc_counter{}s its alloc_tracker::phase and alloc_tracker::featureclass
+// pointers point to; tree_node allocations from the tree_node cache
+// (which doesn't go through operator new) are counted separately.
+//
+// alloc_counter{}           allocation and byte counts
+// alloc_tracker::enabled    turns tracking on (off by default)
+// alloc_tracker::scope{}    points phase or featureclass at a counter
+//                           for the lifetime of the scope
+
+#ifndef ALLOC_TRACKER_H
+#define ALLOC_TRACKER_H
+
+#include <cstddef>
+
+//! alloc_counter{} counts allocations and allocated bytes
+//
+struct alloc_counter {
+  size_t nallocs;     //!< calls to operator new
+  size_t nbytes;      //!< bytes requested from operator new
+  size_t nnodes;      //!< tree nodes allocated from the tree_node cache
+
+  alloc_counter() : nallocs(0), nbytes(0), nnodes(0) { }
+};  // alloc_counter{}
+
+namespace alloc_tracker {
+
+  extern bool enabled;                        //!< track allocations
+  extern __thread alloc_counter* phase;        //!< counter for the current phase
+  extern __thread alloc_counter* featureclass; //!< counter for the current FeatureClass
+
+  //! count() records an allocation of nbytes
+  //
+  inline void count(size_t nbytes) {
+    if (phase) {
+      ++phase->nallocs;
+      phase->nbytes += nbytes;
+    }
+    if (featureclass) {
+      ++featureclass->nallocs;
+      featureclass->nbytes += nbytes;
+    }
+  }  // alloc_tracker::count()
+
+  //! count_node() records a tree node allocation
+  //
+  inline void count_node() {
+    if (phase)
+      ++phase->nnodes;
+    if (featureclass)
+      ++featureclass->nnodes;
+  }  // alloc_tracker::count_node()
+
+  //! scope{} points slot (phase or featureclass) at counter while
+  //! it exists, if tracking is enabled.
+  //
+  struct scope {
+    alloc_counter*& slot;
+    alloc_counter* saved;
+
+    scope(alloc_counter*& slot, alloc_counter& counter) : slot(slot), saved(slot) {
+      if (enabled)
+	slot = &counter;
+    }
+
+    ~scope() { slot = saved; }
+  };  // alloc_tracker::scope{}
+
+}  // namespace alloc_tracker
+
+#endif // ALLOC_TRACKER_H
@@ -0,0 +1,327 @@
+// bench-primitives.cc -- microbenchmarks for the tree and symbol primitives
+//
+// bench-primitives times the primitives that feature extraction is
+// built on, over the trees of a synth_treebank{} n-best corpus:
+//
+//  symbol-lookup    symbol::symbol(const char*) on already interned strings
+//  symbol-insert    symbol::symbol(const char*) on new strings
+//  symbol-downcase  symbol::downcase() on already interned symbols
+//  readtree         readtree(const char*), per tree
+//  tree_sptree      tree_sptree(), per node
+//  headchild-syn    heads::syntactic().headchild(), per nonterminal
+//  headchild-sem    heads::semantic().headchild(), per nonterminal
+//  precrec-edges    precrec_type::edges construction, per tree
+//
+// Each benchmark is run several times and the fastest run reported,
+// as a tab-separated line with its ns/op and heap allocations and
+// bytes per op (counted by alloc-tracker-new.cc), and the number of tree
+// nodes per op taken from the tree_node cache.
+
+const char usage[] =
+"Usage:\n"
+"\n"
+"bench-primitives [-k <k>] [-l <l>] [-n <n>] [-r <r>] [-t <t>] [-x <x>]\n"
+"\n"
+"where:\n"
+" -k <k> is the number of parses per sentence (default 20),\n"
+" -l <l> is the mean sentence length (default 20),\n"
+" -n <n> is the number of sentences to generate (default 500),\n"
+" -r <r> is the probability of perturbing each node of a parse (default 0.1),\n"
+" -t <t> is the number of times each benchmark is run (default 3),\n"
+" -x <x> is the random number seed (default 1).\n"
+"\n"
+"Output lines are:\n"
+"\n"
+" primitive <name> <ops> <ns/op> <allocs/op> <bytes/op> <tree-nodes/op>\n";
+
+#include "custom_allocator.h"       // must be first
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "alloc-tracker.h"
+#include "heads.h"
+#include "profile.h"
+#include "sptree.h"
+#include "sym.h"
+#include "synth-treebank.h"
+#include "tree.h"
+#include "utility.h"
+
+typedef std::vector<std::string> strings;
+typedef std::vector<tree*> trees;
+typedef std::vector<sptree*> sptrees;
+typedef std::vector<const sptree*> csptrees;
+
+static size_t sink = 0;   // results are folded into sink so they aren't optimized away
+
+//! run() runs bench nrepeats times, and writes the fastest run
+//
+template <typename Bench>
+void run(const char* name, Bench& bench, size_t nrepeats) {
+  double best = -1;
+  size_t ops = 0;
+  alloc_counter allocs;
+  for (size_t r = 0; r < nrepeats; ++r) {
+    bench.setup();
+    alloc_counter counter;
+    double t;
+    {
+      alloc_tracker::scope as(alloc_tracker::phase, counter);
+      double t0 = wall_time();
+      ops = bench.run();
+      t = wall_time() - t0;
+    }
+    if (best < 0 || t < best) {
+      best = t;
+      allocs = counter;
+    }
+    bench.teardown();
+  }
+  if (ops == 0)
+    ops = 1;
+  printf("primitive\t%s\t%u\t%.2f\t%.3f\t%.1f\t%.3f\n", name, unsigned(ops),
+	 1e9*best/ops, double(allocs.nallocs)/ops, double(allocs.nbytes)/ops,
+	 double(allocs.nnodes)/ops);
+  fflush(stdout);
+}  // run()
+
+//! The benchmarks: setup() and teardown() are not timed, and
+//! run() returns the number of operations performed.
+
+struct symbol_lookup {
+  const strings& words;
+  symbol_lookup(const strings& words) : words(words) { }
+  void setup() { cforeach (strings, it, words) symbol s(it->c_str()); }
+  size_t run() {
+    cforeach (strings, it, words)
+      sink += size_t(symbol(it->c_str()).string_pointer());
+    return words.size();
+  }
+  void teardown() { }
+};  // symbol_lookup{}
+
+struct symbol_insert {
+  strings fresh;
+  size_t generation;
+  size_t n;
+  symbol_insert(size_t n) : generation(0), n(n) { }
+  void setup() {   // new strings each run, as interned symbols are never freed
+    fresh.clear();
+    char buf[64];
+    for (size_t i = 0; i < n; ++i) {
+      sprintf(buf, "bench-symbol-%u-%u", unsigned(generation), unsigned(i));
+      fresh.push_back(buf);
+    }
+    ++generation;
+  }
+  size_t run() {
+    cforeach (strings, it, fresh)
+      sink += size_t(symbol(it->c_str()).string_pointer());
+    return fresh.size();
+  }
+  void teardown() { }
+};  // symbol_insert{}
+
+struct symbol_downcase {
+  std::vector<symbol> syms;
+  symbol_downcase(const strings& words) {
+    cforeach (strings, it, words) 
+      syms.push_back(symbol(it->c_str()));
+  }
+  void setup() { cforeach (std::vector<symbol>, it, syms) it->downcase(); }
+  size_t run() {
+    cforeach (std::vector<symbol>, it, syms)
+      sink += size_t(it->downcase().string_pointer());
+    return syms.size();
+  }
+  void teardown() { }
+};  // symbol_downcase{}
+
+struct readtree_bench {
+  const strings& treestrs;
+  trees ts;
+  readtree_bench(const strings& treestrs) : treestrs(treestrs) { }
+  void setup() { ts.reserve(treestrs.size()); }
+  size_t run() {
+    cforeach (strings, it, treestrs)
+      ts.push_back(readtree(it->c_str()));
+    return treestrs.size();
+  }
+  void teardown() {
+    foreach (trees, it, ts)
+      delete *it;
+    ts.clear();
+  }
+};  // readtree_bench{}
+
+struct tree_sptree_bench {
+  const trees& ts;
+  size_t nnodes;
+  sptrees sps;
+  tree_sptree_bench(const trees& ts, size_t nnodes) : ts(ts), nnodes(nnodes) { }
+  void setup() { sps.reserve(ts.size()); }
+  size_t run() {
+    cforeach (trees, it, ts)
+      sps.push_back(tree_sptree(*it));
+    return nnodes;
+  }
+  void teardown() {
+    foreach (sptrees, it, sps)
+      delete *it;
+    sps.clear();
+  }
+};  // tree_sptree_bench{}
+
+template <typename HeadData>
+struct headchild_bench {
+  const HeadData& data;
+  const csptrees& nonterminals;
+  headchild_bench(const HeadData& data, const csptrees& nonterminals)
+    : data(data), nonterminals(nonterminals) { }
+  void setup() { }
+  size_t run() {
+    cforeach (csptrees, it, nonterminals)
+      sink += size_t(data.headchild(*it));
+    return nonterminals.size();
+  }
+  void teardown() { }
+};  // headchild_bench{}
+
+struct edges_bench {
+  const sptrees& sps;
+  edges_bench(const sptrees& sps) : sps(sps) { }
+  void setup() { }
+  size_t run() {
+    cforeach (sptrees, it, sps) {
+      precrec_type::edges es(*it);
+      sink += es.size();
+    }
+    return sps.size();
+  }
+  void teardown() { }
+};  // edges_bench{}
+
+//! collect_nodes() pushes the nonterminal nodes of t onto nts, and
+//! returns the number of nodes in t.
+//
+static size_t collect_nodes(const sptree* t, csptrees& nts) {
+  size_t n = 0;
+  for ( ; t != NULL; t = t->next) {
+    ++n;
+    if (t->is_nonterminal())
+      nts.push_back(t);
+    n += collect_nodes(t->child, nts);
+  }
+  return n;
+}  // collect_nodes()
+
+//! collect_words() pushes the words and categories of treestr onto words
+//
+static void collect_words(const std::string& treestr, strings& words) {
+  std::string w;
+  for (size_t i = 0; i < treestr.size(); ++i) {
+    char c = treestr[i];
+    if (c == '(' || c == ')' || c == ' ') {
+      if (!w.empty())
+	words.push_back(w);
+      w.clear();
+    }
+    else
+      w += c;
+  }
+}  // collect_words()
+
+int main(int argc, char **argv) {
+
+  synth_treebank synth(500);
+  size_t nrepeats = 3;
+  alloc_tracker::enabled = true;
+
+  int c;
+  while ((c = getopt(argc, argv, "k:l:n:r:t:x:")) != -1 )
+    switch (c) {
+    case 'k':
+      synth.nbest = atoi(optarg);
+      break;
+    case 'l':
+      synth.mean_length = atoi(optarg);
+      break;
+    case 'n':
+      synth.nsentences = atoi(optarg);
+      break;
+    case 'r':
+      synth.perturb_rate = atof(optarg);
+      break;
+    case 't':
+      nrepeats = atoi(optarg);
+      break;
+    case 'x':
+      synth.seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      std::cerr << usage << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+  printf("# bench-primitives sentences=%u length=%u nbest=%u rate=%g seed=%llu repeats=%u\n",
+	 unsigned(synth.nsentences), unsigned(synth.mean_length), unsigned(synth.nbest),
+	 synth.perturb_rate, synth.seed, unsigned(nrepeats));
+
+  // generate the corpus and collect its parse trees as strings
+
+  FILE* parsefp = tmpfile();
+  FILE* goldfp = tmpfile();
+  if (parsefp == NULL || goldfp == NULL) {
+    std::cerr << "## Error: can't create temporary files" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  synth.write(parsefp, goldfp);
+  rewind(parsefp);
+  strings treestrs, words;
+  {
+    char buffer[BUFSIZ*4];
+    while (fgets(buffer, sizeof(buffer), parsefp))
+      if (buffer[0] == '(') {
+	treestrs.push_back(buffer);
+	collect_words(treestrs.back(), words);
+      }
+  }
+  fclose(goldfp);
+  fclose(parsefp);
+
+  trees ts;
+  sptrees sps;
+  csptrees nonterminals;
+  size_t nnodes = 0;
+  cforeach (strings, it, treestrs) {
+    ts.push_back(readtree(it->c_str()));
+    sps.push_back(tree_sptree(ts.back()));
+    nnodes += collect_nodes(sps.back(), nonterminals);
+  }
+
+  printf("# primitive\tname\tops\tns_per_op\tallocs_per_op\tbytes_per_op\tnodes_per_op\n");
+
+  symbol_lookup sl(words);
+  run("symbol-lookup", sl, nrepeats);
+  symbol_insert si(words.size());
+  run("symbol-insert", si, nrepeats);
+  symbol_downcase sd(words);
+  run("symbol-downcase", sd, nrepeats);
+  readtree_bench rb(treestrs);
+  run("readtree", rb, nrepeats);
+  tree_sptree_bench tsb(ts, nnodes);
+  run("tree_sptree", tsb, nrepeats);
+  headchild_bench<heads::syntactic_data> hsyn(heads::syntactic(), nonterminals);
+  run("headchild-syn", hsyn, nrepeats);
+  headchild_bench<heads::semantic_data> hsem(heads::semantic(), nonterminals);
+  run("headchild-sem", hsem, nrepeats);
+  edges_bench eb(sps);
+  run("precrec-edges", eb, nrepeats);
+
+  if (sink == 42)   // keep sink alive
+    std::cerr << sink << std::endl;
+}  // main()
@@ -0,0 +1,227 @@
+// bench-spfeatures.cc -- benchmark feature extraction on a synthetic treebank
+//
+// bench-spfeatures generates a synthetic n-best treebank with
+// synth_treebank{}, then times the phases of extract-spfeatures
+// (count, prune, write) and each feature class in isolation.
+// The results are written to stdout as tab-separated lines, so
+// runs with the same parameters can be compared mechanically.
+
+const char usage[] =
+"Usage:\n"
+"\n"
+"bench-spfeatures [-d <d>] [-f <f>] [-g <prefix>] [-k <k>] [-l <l>] [-n <n>] [-r <r>] [-s <s>]\n"
+"  [-t <tmpdir>] [-v <v>] [-x <x>]\n"
+"\n"
+"where:\n"
+" -d <d> keeps the features in one shared dictionary sized for <d> features\n"
+"    (0 = grow as needed) rather than a hash table per feature class,\n"
+" -f <f> uses feature classes <f>: local, sp, spnn, a list of identifier patterns\n"
+"    such as \"Rule:0:*,Edges:1:*\", or @file (as for extract-spfeatures),\n"
+" -g <prefix> only writes the treebank, to <prefix>.nbest and <prefix>.gold, and exits,\n"
+" -k <k> is the number of parses per sentence (default 20),\n"
+" -l <l> is the mean sentence length (default 20),\n"
+" -n <n> is the number of sentences to generate (default 1000),\n"
+" -r <r> is the probability of perturbing each node of a parse (default 0.1),\n"
+" -s <s> is the number of sentences a feature must appear in not to be pruned (default 2),\n"
+" -t <tmpdir> is the directory the treebank is written to (default /tmp),\n"
+" -v <v> is the number of distinct words per open-class tag (default 2000),\n"
+" -x <x> is the random number seed (default 1).\n"
+"\n"
+"Output lines are:\n"
+"\n"
+" phase <name> <wall-secs> <cpu-secs> <sentences> <parses> <features>\n"
+" dictionary <phase> <bytes> <features>\n"
+" class <identifier> <extract-secs> <prune-secs> <values-secs> <features>\n";
+
+#include "custom_allocator.h"       // must be first
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "sp-data.h"
+#include "features.h"
+#include "synth-treebank.h"
+#include "utility.h"
+
+//! write_phase() writes a phase line
+//
+static void write_phase(const char* name, double wall0, double cpu0,
+			size_t nsentences, size_t nparses, size_t nfeatures) {
+  printf("phase\t%s\t%.6f\t%.6f\t%u\t%u\t%u\n", name, wall_time()-wall0, cpu_time()-cpu0,
+	 unsigned(nsentences), unsigned(nparses), unsigned(nfeatures));
+  fflush(stdout);
+}  // write_phase()
+
+//! write_dictionary() writes a dictionary line, with the approximate
+//! memory used by all the feature classes' dictionaries
+//
+static void write_dictionary(const char* phase, const FeatureClassPtrs& fcps) {
+  size_t nbytes = 0, nfeatures = 0;
+  cforeach (FeatureClassPtrs, it, fcps) {
+    nbytes += (*it)->dictionary_bytes();
+    nfeatures += (*it)->nfeatures();
+  }
+  printf("dictionary\t%s\t%lu\t%lu\n", phase, (unsigned long) nbytes, (unsigned long) nfeatures);
+  fflush(stdout);
+}  // write_dictionary()
+
+int main(int argc, char **argv) {
+
+  collect_correct = collect_incorrect = true;
+
+  synth_treebank synth;
+  const char* fcname = NULL;
+  size_type mincount = 2;
+  std::string tmpdir = "/tmp";
+  const char* prefix = NULL;
+
+  int c;
+  while ((c = getopt(argc, argv, "d:f:g:k:l:n:r:s:t:v:x:")) != -1 )
+    switch (c) {
+    case 'd':
+      shared_feature_dictionary::enabled = true;
+      shared_feature_dictionary::global().reserve(atol(optarg));
+      break;
+    case 'f':
+      fcname = optarg;
+      break;
+    case 'g':
+      prefix = optarg;
+      break;
+    case 'k':
+      synth.nbest = atoi(optarg);
+      break;
+    case 'l':
+      synth.mean_length = atoi(optarg);
+      break;
+    case 'n':
+      synth.nsentences = atoi(optarg);
+      break;
+    case 'r':
+      synth.perturb_rate = atof(optarg);
+      break;
+    case 's':
+      mincount = atoi(optarg);
+      break;
+    case 't':
+      tmpdir = optarg;
+      break;
+    case 'v':
+      synth.vocabulary = atoi(optarg);
+      break;
+    case 'x':
+      synth.seed = strtoull(optarg, NULL, 10);
+      break;
+    default:
+      std::cerr << usage << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+  if (prefix != NULL) {
+    std::string parsefile = std::string(prefix) + ".nbest", goldfile = std::string(prefix) + ".gold";
+    if (!synth.write(parsefile.c_str(), goldfile.c_str())) {
+      std::cerr << "## Error: can't write treebank to " << prefix << ".*" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
+  }
+
+  printf("# bench-spfeatures sentences=%u length=%u nbest=%u rate=%g vocabulary=%u "
+	 "seed=%llu features=%s mincount=%u shared_dictionary=%d\n",
+	 unsigned(synth.nsentences), unsigned(synth.mean_length), unsigned(synth.nbest),
+	 synth.perturb_rate, unsigned(synth.vocabulary), synth.seed,
+	 fcname ? fcname : "NULL", unsigned(mincount), int(shared_feature_dictionary::enabled));
+
+  std::string dir = tmpdir + "/bench-spfeatures-XXXXXX";
+  if (mkdtemp(&dir[0]) == NULL) {
+    std::cerr << "## Error: can't create temporary directory in " << tmpdir << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::string parsefile = dir + "/nbest", goldfile = dir + "/gold", outfile = dir + "/out";
+  std::string parsecmd = "cat " + parsefile, goldcmd = "cat " + goldfile;
+
+  double wall0 = wall_time(), cpu0 = cpu_time();
+  if (!synth.write(parsefile.c_str(), goldfile.c_str())) {
+    std::cerr << "## Error: can't write treebank to " << dir << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  write_phase("generate", wall0, cpu0, synth.nsentences, 0, 0);
+
+  // time the phases of extract-spfeatures
+
+  printf("# phase\tname\twall_secs\tcpu_secs\tsentences\tparses\tfeatures\n");
+  std::ofstream null("/dev/null");
+  {
+    FeatureClassPtrs fcps(fcname);
+
+    wall0 = wall_time(); cpu0 = cpu_time();
+    fcps.extract_features(parsecmd.c_str(), goldcmd.c_str());
+    size_t nfeatures = 0;
+    cforeach (FeatureClassPtrs, it, fcps)
+      nfeatures += (*it)->nfeatures();
+    write_phase("count", wall0, cpu0, fcps.stats.nsentences, fcps.stats.nparses, nfeatures);
+    write_dictionary("count", fcps);
+
+    wall0 = wall_time(); cpu0 = cpu_time();
+    Id nkept = fcps.prune_and_renumber(mincount, null);
+    write_phase("prune", wall0, cpu0, 0, 0, nkept);
+    write_dictionary("prune", fcps);
+
+    wall0 = wall_time(); cpu0 = cpu_time();
+    fcps.write_features(parsecmd.c_str(), goldcmd.c_str(), outfile.c_str());
+    write_phase("write", wall0, cpu0, fcps.stats.nsentences, fcps.stats.nparses, nkept);
+  }
+
+  // time each feature class on its own, on a corpus held in memory
+
+  sp_corpus_type corpus;
+  corpus.keep_raw_trees = false;  // as in extract-spfeatures
+  {
+    FILE* parsefp = fopen(parsefile.c_str(), "r");
+    FILE* goldfp = fopen(goldfile.c_str(), "r");
+    wall0 = wall_time(); cpu0 = cpu_time();
+    if (parsefp == NULL || goldfp == NULL || !corpus.read(parsefp, goldfp)) {
+      std::cerr << "## Error: can't read treebank from " << dir << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    fclose(goldfp);
+    fclose(parsefp);
+    size_t nparses = 0;
+    cforeach (sp_sentences_type, it, corpus.sentences)
+      nparses += it->nparses();
+    write_phase("read", wall0, cpu0, corpus.nsentences(), nparses, 0);
+  }
+
+  printf("# class\tidentifier\textract_secs\tprune_secs\tvalues_secs\tfeatures\n");
+  FeatureClassPtrs fcps(fcname);
+  Id_Floats p_i_v;
+  foreach (FeatureClassPtrs, it, fcps) {
+    FeatureClass* fc = *it;
+
+    double t0 = wall_time();
+    cforeach (sp_sentences_type, sit, corpus.sentences)
+      fc->extract_features(*sit);
+    double t1 = wall_time();
+    Id nkept = fc->prune_and_renumber(mincount, 0, null);
+    double t2 = wall_time();
+    cforeach (sp_sentences_type, sit, corpus.sentences) {
+      p_i_v.clear();
+      p_i_v.resize(sit->nparses());
+      fc->feature_values(*sit, p_i_v);
+    }
+    double t3 = wall_time();
+
+    printf("class\t%s\t%.6f\t%.6f\t%.6f\t%u\n", fc->identifier(),
+	   t1-t0, t2-t1, t3-t2, unsigned(nkept));
+    fflush(stdout);
+  }
+
+  unlink(outfile.c_str());
+  unlink(goldfile.c_str());
+  unlink(parsefile.c_str());
+  rmdir(dir.c_str());
+}  // main()
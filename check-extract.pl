@@ -0,0 +1,245 @@
+#!/usr/bin/perl
+
+# This script checks that extract-spfeatures writes the same features
+# in all of its modes.  It generates a synthetic train set, a dev set
+# with gold trees and a test set without them (with bench-spfeatures
+# -g), extracts their features with -j1 and with each of the
+# concurrent modes (-j4, --procs 3, --shared-dictionary and several
+# -s thresholds at once), and compares each mode's feature map and
+# feature files with the -j1 ones.  It checks that the test set's
+# features are the same as when it is given a fake gold file holding
+# each n-best list's first parse (as extract.pl once made), apart from
+# the G=, P= and W= fields.  It then reranks the dev set with
+# random weights, with relative and with absolute (-a) counts, and
+# checks that rerank picks the same parses as when it sums each
+# parse's feature values (-u).
+#
+# Feature ids are assigned in a different order in each mode, so the
+# outputs are compared after mapping every id back to its feature
+# string and sorting each parse's features.  It prints one line per
+# mode and per rerank check, and exits with status 1 if any differs.
+#
+# usage: check-extract.pl [-n <sentences>] [-k] [workdir]
+#
+# -n sets the number of training sentences (default 300), and -k keeps
+# workdir (default /tmp/check-extract-<pid>) afterwards.
+
+use strict;
+use warnings;
+use File::Basename;
+use File::Path qw/rmtree/;
+use Getopt::Long;
+
+my $nsentences = 300;
+my $keep = 0;
+GetOptions("n=i" => \$nsentences,
+		   "k" => \$keep) or die "usage: $0 [-n <sentences>] [-k] [workdir]\n";
+my $dir = shift || "/tmp/check-extract-$$";
+
+my $bindir = dirname($0);
+my $extract = "$bindir/extract-spfeatures";
+my $bench = "$bindir/bench-spfeatures";
+my $rerank = "$bindir/rerank";
+foreach my $program ($extract, $bench, $rerank) {
+  die "* FATAL: can't find '$program' (did you run make?)\n" unless -x $program;
+}
+
+mkdir $dir or die "* FATAL: can't create $dir\n";
+run("$bench -g $dir/train -n $nsentences");
+run("$bench -g $dir/dev -n " . int($nsentences/3 + 1) . " -x 2");
+run("$bench -g $dir/test -n " . int($nsentences/3 + 1) . " -x 3");
+
+my @sets = ("train", "dev", "test");
+
+# the modes compared, and the thresholds each writes; the first
+# mode of each threshold is the reference
+
+my @modes = (["j1", "-j1 -s 2", 2],
+			 ["j1-s3", "-j1 -s 3", 3],
+			 ["j4", "-j4 -s 2", 2],
+			 ["procs3", "--procs 3 -s 2", 2],
+			 ["shared", "-j4 -s 2 --shared-dictionary 0", 2],
+			 ["j4-s2,3", "-j4 -s 2,3", 2, 3],
+			 ["procs3-s2,3", "--procs 3 -s 2,3", 2, 3]);
+
+my %reference;   # threshold -> [map, feature files...] in canonical form
+my $ndiffer = 0;
+foreach my $mode (@modes) {
+  my ($name, $flags, @thresholds) = @$mode;
+  my $out = "$dir/$name";
+  mkdir $out or die "* FATAL: can't create $out\n";
+  my $args = join(" ", map { "'cat $dir/$_.nbest' " . ($_ eq "test" ? "-" : "'cat $dir/$_.gold'")
+							   . " $out/$_" } @sets);
+  run("$extract -c -i $flags $args > $out/map 2> $out/err");
+  foreach my $threshold (@thresholds) {
+	my $suffix = @thresholds > 1 ? ".s$threshold" : "";
+	my $mapfile = @thresholds > 1 ? "$out/train.s$threshold.map" : "$out/map";
+	my %map = read_map($mapfile);
+	my @canonical = (join("\n", sort values %map));
+	push(@canonical, canonical_features("$out/$_$suffix", \%map)) foreach @sets;
+	my $what = "$name (-s $threshold)";
+	if (! exists $reference{$threshold}) {
+	  $reference{$threshold} = [$what, @canonical];
+	  print "$what: reference\n";
+	  next;
+	}
+	my ($refname, @ref) = @{$reference{$threshold}};
+	my @differ;
+	foreach my $i (0..$#ref) {
+	  push(@differ, $i == 0 ? "map" : $sets[$i-1]) if $ref[$i] ne $canonical[$i];
+	}
+	if (@differ) {
+	  print "$what: DIFFERS from $refname in @differ\n";
+	  ++$ndiffer;
+	}
+	else {
+	  print "$what: same as $refname\n";
+	}
+  }
+}
+
+# extract the test set again with a fake gold file holding the first
+# parse of each n-best list, and compare it with the -j1 one
+
+write_fake_gold("$dir/test.nbest", "$dir/test.fakegold");
+mkdir "$dir/fakegold" or die "* FATAL: can't create $dir/fakegold\n";
+run("$extract -c -i -j1 -s 2 " 
+	. join(" ", map { "'cat $dir/$_.nbest' 'cat $dir/" . ($_ eq "test" ? "test.fakegold" : "$_.gold")
+						  . "' $dir/fakegold/$_" } @sets)
+	. " > $dir/fakegold/map 2> $dir/fakegold/err");
+{
+  my %refmap = read_map("$dir/j1/map");
+  my %map = read_map("$dir/fakegold/map");
+  if (join("\n", sort values %map) ne join("\n", sort values %refmap)
+	  || canonical_features("$dir/fakegold/test", \%map, 1) 
+	     ne canonical_features("$dir/j1/test", \%refmap, 1)) {
+	print "test with fake gold: DIFFERS from j1 (-s 2) without gold\n";
+	++$ndiffer;
+  }
+  else {
+	print "test with fake gold: same as j1 (-s 2) without gold, but for G=, P= and W=\n";
+  }
+}
+
+# rerank the dev set with the -j1 map, and with a map extracted with
+# absolute counts, using the fused scorer and with -u
+
+mkdir "$dir/abs" or die "* FATAL: can't create $dir/abs\n";
+run("$extract -a -c -i -j1 -s 2 'cat $dir/train.nbest' 'cat $dir/train.gold' $dir/abs/train"
+	. " > $dir/abs/map 2> $dir/abs/err");
+foreach my $check (["rerank", "", "$dir/j1"], ["rerank -a", "-a", "$dir/abs"]) {
+  my ($what, $flags, $out) = @$check;
+  write_weights("$out/map", "$out/weights");
+  foreach my $scorer (["fused", ""], ["unfused", "-u"]) {
+	my ($name, $flag) = @$scorer;
+	run("$rerank $flags $flag $out/map $out/weights < $dir/dev.nbest"
+		. " > $out/$name.parses 2> $out/$name.err");
+  }
+  if (slurp("$out/fused.parses") ne slurp("$out/unfused.parses")) {
+	print "$what: fused scores DIFFER from -u\n";
+	++$ndiffer;
+  }
+  else {
+	print "$what: fused scores same as -u\n";
+  }
+}
+
+rmtree($dir) unless $keep;
+exit($ndiffer ? 1 : 0);
+
+# run() runs a shell command, dying if it fails
+sub run {
+  my ($command) = @_;
+  system($command) == 0 or die "* FATAL: '$command' failed\n";
+}
+
+# read_map() reads a feature map into a hash from ids to features
+sub read_map {
+  my ($file) = @_;
+  my %map;
+  open(my $fh, "<", $file) or die "* FATAL: can't read $file\n";
+  while (my $line = <$fh>) {
+	chomp($line);
+	my ($id, $feature) = split(/\t/, $line, 2);
+	$map{$id} = $feature;
+  }
+  close($fh);
+  return %map;
+}
+
+# write_weights() writes repeatable random weights for about two
+# thirds of the ids in the feature map $mapfile to $file
+sub write_weights {
+  my ($mapfile, $file) = @_;
+  my %map = read_map($mapfile);
+  srand(1);
+  open(my $fh, ">", $file) or die "* FATAL: can't write $file\n";
+  foreach my $id (sort { $a <=> $b } keys %map) {
+	my $w = rand(2) - 1;
+	printf $fh "%d=%.6g\n", $id, $w if rand(3) >= 1;
+  }
+  close($fh);
+}
+
+# slurp() returns the contents of $file
+sub slurp {
+  my ($file) = @_;
+  open(my $fh, "<", $file) or die "* FATAL: can't read $file\n";
+  local $/;
+  my $contents = <$fh>;
+  close($fh);
+  return $contents;
+}
+
+# write_fake_gold() writes a gold file for the n-best file $nbest to
+# $file, taking each sentence's first parse as its gold tree
+sub write_fake_gold {
+  my ($nbest, $file) = @_;
+  open(my $in, "<", $nbest) or die "* FATAL: can't read $nbest\n";
+  my @gold;
+  while (my $header = <$in>) {
+	next if $header =~ /^\s*$/;
+	my ($nparses, $label) = split(' ', $header);
+	for (my $i = 0; $i < $nparses; ++$i) {
+	  my $logprob = <$in>;
+	  my $tree = <$in>;
+	  die "* FATAL: $nbest ends in the middle of sentence $label\n" unless defined $tree;
+	  chomp($tree);
+	  push(@gold, "$label\t$tree") if $i == 0;
+	}
+  }
+  close($in);
+  open(my $out, ">", $file) or die "* FATAL: can't write $file\n";
+  print $out scalar(@gold), "\n";
+  print $out "$_\n" foreach @gold;
+  close($out);
+}
+
+# canonical_features() returns the feature file $file with each id
+# replaced by its feature and each parse's features sorted; with
+# $nogold set, the G=, P= and W= fields are dropped
+sub canonical_features {
+  my ($file, $map, $nogold) = @_;
+  open(my $fh, "<", $file) or die "* FATAL: can't read $file\n";
+  my @lines;
+  while (my $line = <$fh>) {
+	chomp($line);
+	my @parses;
+	foreach my $parse (split(/,/, $line, -1)) {
+	  my (@fields, @features);
+	  foreach my $token (split(' ', $parse)) {
+		if ($token =~ /^(\d+)(?:=(.*))?$/) {
+		  die "* FATAL: $file: id $1 isn't in the feature map\n" unless exists $map->{$1};
+		  push(@features, $map->{$1} . "=" . (defined $2 ? $2 : 1));
+		}
+		elsif (! ($nogold && $token =~ /^[GPW]=/)) {
+		  push(@fields, $token);
+		}
+	  }
+	  push(@parses, join(" ", @fields, sort @features));
+	}
+	push(@lines, join(",", @parses));
+  }
+  close($fh);
+  return join("\n", @lines);
+}
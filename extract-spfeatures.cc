@@ -5,7 +5,9 @@
 const char usage[] =
 "Usage:\n"
 "\n"
-"extract-spfeatures [-a] [-c] [-d <debug>] [-f <f>] [-i] [-l] [-s <s>] \n"
+"extract-spfeatures [-a] [-c] [-d <debug>] [-f <f>] [-i] [-l] [-m <m>] [-p] [-s <s>[,<s>...]] [-j <j>]\n"
+"  [--trace <trace.json>] [--trace-every <n>] [--allocs]\n"
+"  [--max-features <k>] [--verify-max-features] [--shared-dictionary <n>] [--procs <n>]\n"
 "  train.nbest.cmd train.gold.cmd train.gz\n"
 " (dev.nbest.cmd dev.gold.cmd dev.gz)*\n"
 "\n"
@@ -14,27 +16,55 @@ const char usage[] =
 " -e always extract features (i.e., don't skip features that are the same for all instances, and don't skip length-1 1-best lists),\n"
 " -c collect features from correct examples,\n"
 " -d <debug> turns on debugging output,\n"
-" -f <f> uses feature classes <f>,\n"
+" -f <f> uses feature classes <f>: one of the sets local, sp or spnn, or a list of\n"
+"    identifier patterns such as \"Rule:0:*,Edges:1:*\" or \"*,!NGramTree:*\" (a '!'\n"
+"    pattern drops the classes it matches), or @file to read the patterns from file,\n"
 " -i collect features from incorrect examples,\n"
+" -j <j> prunes the feature classes and computes the data sets' features on <j> threads\n"
+"    (default 1; 0 uses one thread per processor),\n"
 " -l maps all words to lower case as trees are read,\n"
-" -s <s> is the number of sentences a feature must appear in not to be pruned,\n"
+" -m <m> writes a progress line to stderr every <m> sentences,\n"
+" -p writes a per-feature-class profile (time, feature counts, dictionary size) to stderr,\n"
+" -s <s> is the number of sentences a feature must appear in not to be pruned;\n"
+"    with a comma-separated list of thresholds the features are counted once, and\n"
+"    a feature map and a set of feature files are written for each threshold,\n"
+"    named by inserting .s<s> before the output files' .gz or .bz2 suffix, the\n"
+"    feature map going to train.s<s>.map (for train output file train.gz),\n"
+" --trace <trace.json> writes a Chrome trace-event timeline to <trace.json>,\n"
+" --trace-every <n> only traces every <n>th sentence (default 1),\n"
+" --allocs counts heap allocations per phase and feature class (implies -p),\n"
+" --max-features <k> keeps only the <k> most frequent features of each feature class,\n"
+"    counting at most 2<k> candidates per class (so counts may be underestimated),\n"
+" --verify-max-features rereads train.nbest.cmd to count the candidates exactly,\n"
+"    so that the features kept are the true <k> most frequent, and fails if a\n"
+"    feature dropped while counting might have been among them,\n"
+" --shared-dictionary <n> keeps every feature class's features in one shared table,\n"
+"    sized for <n> features (0 = grow as needed), rather than a hash table per class,\n"
+" --procs <n> writes the data sets with <n> forked worker processes, each computing\n"
+"    every <n>th block of sentences, rather than with threads (-j then only applies\n"
+"    to pruning; -p and --trace force --procs 1),\n"
 "\n"
 " train.nbest.cmd produces the n-best parses for training the reranker,\n"
 " train.gold.cmd is a command which produces the corresponding gold parses,\n"
+"    or \"-\" if there are none (the G=, P= and W= fields are then omitted),\n"
 " train.gz is the file into which the extracted features are written,\n"
 " dev.nbest.cmd, dev.gold.cmd and dev.gz are corresponding development files.\n"
 "\n"
-"The extracted features are written to standard output.\n";
+"The extracted features are written to standard output (with a single -s threshold).\n";
 
 #include "custom_allocator.h"       // must be first
 
 // #define _GLIBCPP_CONCEPT_CHECKS  // uncomment this for checking
 
 // #include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <fstream>
+#include <getopt.h>
 #include <map>
+#include <sstream>
 #include <unistd.h>
 #include <vector>
 
@@ -42,24 +72,37 @@ const char usage[] =
 #include "features.h"
 #include "utility.h"
 
-bool force_extract = false;
-int debug_level = 0;
-bool absolute_counts = false;
-bool collect_correct = false;
-bool collect_incorrect = false;
-bool lowercase_flag = false;
+enum { TRACE_OPTION = 256, TRACE_EVERY_OPTION, ALLOCS_OPTION, MAX_FEATURES_OPTION,
+       VERIFY_MAX_FEATURES_OPTION, SHARED_DICTIONARY_OPTION, PROCS_OPTION };
+
+static struct option long_options[] = {
+  { "trace", required_argument, NULL, TRACE_OPTION },
+  { "trace-every", required_argument, NULL, TRACE_EVERY_OPTION },
+  { "allocs", no_argument, NULL, ALLOCS_OPTION },
+  { "max-features", required_argument, NULL, MAX_FEATURES_OPTION },
+  { "verify-max-features", no_argument, NULL, VERIFY_MAX_FEATURES_OPTION },
+  { "shared-dictionary", required_argument, NULL, SHARED_DICTIONARY_OPTION },
+  { "procs", required_argument, NULL, PROCS_OPTION },
+  { NULL, 0, NULL, 0 }
+};
 
 int main(int argc, char **argv) {
 
   std::ios::sync_with_stdio(false);
 
-  size_t mincount = 1;    // (-s)  minimum number of sentences a feature must occur
-                          //  in to be counted
+  std::vector<size_type> mincounts(1, 1);  // (-s)  minimum numbers of sentences a feature
+                                           //  must occur in to be counted
 
   const char* fcname = NULL;
+  const char* trace_filename = NULL;  // (--trace) trace-event output file
+  size_t trace_every = 1;             // (--trace-every) sentence sampling interval
+  bool verify_max_features = false;   // (--verify-max-features) recount candidates exactly
+  size_t nthreads = 1;                // (-j) threads for pruning and writing
+  size_t shared_dictionary_size = 0;  // (--shared-dictionary) expected number of features
+  size_t nprocs = 1;                  // (--procs) worker processes for writing
 
   int c;
-  while ((c = getopt(argc, argv, "acd:ef:ils:")) != -1 )
+  while ((c = getopt_long(argc, argv, "acd:ef:ij:lm:ps:", long_options, NULL)) != -1 )
     switch (c) {
     case 'a':
       absolute_counts = true;
@@ -79,11 +122,58 @@ int main(int argc, char **argv) {
     case 'i':
       collect_incorrect = true;
       break;
+    case 'j':
+      nthreads = atoi(optarg);
+      break;
     case 'l':
       lowercase_flag = true;
       break;
+    case 'm':
+      progress_interval = atol(optarg);
+      break;
+    case 'p':
+      profile_flag = true;
+      break;
     case 's':
-      mincount = atoi(optarg);
+      mincounts.clear();
+      for (char* s = optarg; *s; ) {
+	mincounts.push_back(strtoul(s, &s, 10));
+	if (*s == ',')
+	  ++s;
+	else if (*s) {
+	  std::cerr << "## Error: can't interpret -s " << optarg << std::endl;
+	  exit(EXIT_FAILURE);
+	}
+      }
+      if (mincounts.empty()) {
+	std::cerr << "## Error: -s needs at least one threshold" << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      std::sort(mincounts.begin(), mincounts.end());
+      mincounts.erase(std::unique(mincounts.begin(), mincounts.end()), mincounts.end());
+      break;
+    case TRACE_OPTION:
+      trace_filename = optarg;
+      break;
+    case TRACE_EVERY_OPTION:
+      trace_every = atol(optarg);
+      break;
+    case ALLOCS_OPTION:
+      alloc_tracker::enabled = true;
+      profile_flag = true;
+      break;
+    case MAX_FEATURES_OPTION:
+      max_features = atol(optarg);
+      break;
+    case VERIFY_MAX_FEATURES_OPTION:
+      verify_max_features = true;
+      break;
+    case SHARED_DICTIONARY_OPTION:
+      shared_feature_dictionary::enabled = true;
+      shared_dictionary_size = atol(optarg);
+      break;
+    case PROCS_OPTION:
+      nprocs = atol(optarg);
       break;
     default:
       std::cerr << "## Error: can't interpret argument " << c << " " << optarg << std::endl;
@@ -96,15 +186,29 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
+  if (nthreads == 0)
+    nthreads = thread_pool::default_nthreads();
+
   std::cerr 
     << "# debug_level (-d) = " << debug_level
     << ", featureclasses (-f) = " << (fcname ? fcname : "NULL")
     << ", absolute_counts (-a) = " << absolute_counts
     << ", collect_correct (-c) = " << collect_correct
     << ", collect_incorrect (-i) = " << collect_incorrect
-    << ", mincount (-s) = " << mincount 
+    << ", mincount (-s) = " << mincounts
+    << ", nthreads (-j) = " << nthreads
     << ", lowercase_flag (-l) = " << lowercase_flag
     << ", force_extract (-e) = " << force_extract
+    << ", progress_interval (-m) = " << progress_interval
+    << ", profile_flag (-p) = " << profile_flag
+    << ", trace (--trace) = " << (trace_filename ? trace_filename : "NULL")
+    << ", trace_every (--trace-every) = " << trace_every
+    << ", allocs (--allocs) = " << alloc_tracker::enabled
+    << ", max_features (--max-features) = " << max_features
+    << ", verify_max_features (--verify-max-features) = " << verify_max_features
+    << ", shared_dictionary (--shared-dictionary) = " << shared_feature_dictionary::enabled
+    << ", shared_dictionary_size = " << shared_dictionary_size
+    << ", nprocs (--procs) = " << nprocs
     << std::endl;
 
   if (collect_correct == false && collect_incorrect == false) {
@@ -112,32 +216,71 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
   
+  if (trace_filename)
+    tracer::enable(trace_every);
+
   // initialize feature classes
   //
+  if (shared_feature_dictionary::enabled)
+    shared_feature_dictionary::global().reserve(shared_dictionary_size);
   FeatureClassPtrs fcps(fcname);
 
   // extract features from training data
   
-  if (collect_correct || collect_incorrect)
+  if (collect_correct || collect_incorrect) {
     fcps.extract_features(argv[optind], argv[optind+1]);   
+    std::cerr << "# " << fcps.stats << ", usage " << resource_usage() << std::endl;
+    if (max_features > 0 && verify_max_features) {
+      fcps.recount_features(argv[optind], argv[optind+1]);
+      std::cerr << "# " << fcps.stats << ", usage " << resource_usage() << std::endl;
+      std::string error;
+      if (!fcps.max_features_certain(mincounts[0], error)) {
+	std::cerr << "## Error: " << error << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    }
+  }
 
-  Id maxid = fcps.prune_and_renumber(mincount);
-  std::cerr << "# maxid = " << maxid << ", usage " << resource_usage() << std::endl;
+  if (mincounts.size() == 1) {
+    Id maxid = fcps.prune_and_renumber(mincounts[0], std::cout, nthreads);
+    std::cerr << "# maxid = " << maxid << ", " << fcps.stats 
+	      << ", usage " << resource_usage() << std::endl;
+  }
+  else {
+    // prune at the lowest threshold, then derive the others' ids from it
+    
+    const char* trainfile = argv[optind+2];
+    for (size_type t = 0; t < mincounts.size(); ++t) {
+      std::string mapfile = FeatureClassPtrs::threshold_filename(trainfile, mincounts[t], ".map");
+      std::ofstream os(mapfile.c_str());
+      if (!os) {
+	std::cerr << "## Error: can't open feature map " << mapfile << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      Id maxid = (t == 0 
+		  ? fcps.prune_and_renumber(mincounts[t], os, nthreads)
+		  : fcps.add_threshold(mincounts[t], os));
+      std::cerr << "# mincount = " << mincounts[t] << ", maxid = " << maxid 
+		<< ", feature map " << mapfile << ", " << fcps.stats 
+		<< ", usage " << resource_usage() << std::endl;
+    }
+  }
 
-  std::cerr << "# reading from \"" << argv[optind] 
-	    << "\" and \"" << argv[optind+1]
-	    << "\", writing to " << argv[optind+2] << ',' << std::flush;
+  // write the train set and the dev sets concurrently
 
-  fcps.write_features(argv[optind], argv[optind+1], argv[optind+2]); // write train set
-  std::cerr << " usage " << resource_usage() << std::endl;
+  if (profile_flag || trace_filename)   // the workers' counters and spans would be lost
+    nprocs = 1;
+  if (nprocs > 1)
+    fcps.write_features_forked(argv + optind, (argc - optind)/3, nprocs);
+  else
+    fcps.write_features(argv + optind, (argc - optind)/3, nthreads);
 
-  for (int i = optind+3; i+1 < argc; i += 3) {
-    std::cerr << "# reading from \"" << argv[i] 
-	      << "\" and \"" << argv[i+1]
-	      << "\", writing to " << argv[i+2] << ',' << std::flush;
+  if (profile_flag)
+    fcps.write_profile(std::cerr);
 
-    fcps.write_features(argv[i], argv[i+1], argv[i+2]);   // write dev set
-    std::cerr << " usage " << resource_usage() << std::endl;
+  if (trace_filename && !tracer::write(trace_filename)) {
+    std::cerr << "## Error: can't write trace to " << trace_filename << std::endl;
+    exit(EXIT_FAILURE);
   }
 
 } // main()
@@ -3,9 +3,8 @@
 
 # This script extracts the Charniak & Johnson feature set from a
 # single parse tree presented to it on STDIN.  It is a wrapper around
-# Charniak and Johnson's extract-spfeatures program, which doesn't
-# work unless you also provide gold standard parse trees and format
-# the data in a very particular manner.
+# Charniak and Johnson's extract-spfeatures program, which needs the
+# data formatted in a very particular manner.
 
 use strict;
 use warnings;
@@ -85,13 +84,12 @@ while (my $line = <>) {
   push(@parses,$parse);
 }
 
-# get some temporary files.  C&J's feature extractor expects parallel
-# gold-standard parse trees in addition to the trees you send it, and
-# each tree set has to be in a very specific format.
+# get a temporary file.  C&J's feature extractor expects the trees
+# in a very specific format.  We have no gold-standard trees, so we
+# pass it "-" as the gold command.
 my ($parsefh, $parsefilename) = tempfile();
-my ($goldfh,  $goldfilename)  = tempfile();
 
-# generate the two files.  The parse tree file has three lines of
+# generate the file.  The parse tree file has three lines of
 # information for each parse tree candidate:
 #
 # NUMCANDIDATES [tab] SENTENCEID
@@ -101,21 +99,14 @@ my ($goldfh,  $goldfilename)  = tempfile();
 # CAND2 PARSE TREE
 # ...
 #
-# The gold standard file has one line at the top indicating the number
-# of entries, and then a single line for each tree, in the format:
-#
-# SENTENCEID [tab] PARSE TREE
-#
 # Since we're not doing n-best reranking, we have just one item on
 # each n-best list.
-print $goldfh (scalar @scores) . $/;
 for (my $i = 0; $i <= $#scores; $i++) {
   print $parsefh "1\tid.$i\n";
   print $parsefh "$scores[$i]\n";
   print $parsefh "$parses[$i]\n";
-  
-  print $goldfh "id.$i\t$parses[$i]\n";
 }
+close($parsefh);
 
 # extract-spfeatures writes the feature file to the file indicated by
 # its third argument, and the feature mapping to STDOUT.  we have to
@@ -125,7 +116,7 @@ my ($featurefilename) = mktemp("/tmp/XXXX");
 my ($mapfilename) = mktemp("/tmp/XXXX");
 
 my $local = ($do_local_only) ? "-f local" : "";
-my $cmd = qq($extract -s $mincount -ciae $local "cat $parsefilename" "cat $goldfilename" $featurefilename > $mapfilename 2> /dev/null);
+my $cmd = qq($extract -s $mincount -ciae $local "cat $parsefilename" - $featurefilename > $mapfilename 2> /dev/null);
 system($cmd);
 
 # now read in the feature mapping, if necessary
@@ -152,7 +143,7 @@ while ($_ = <FEATURES>) {
   chomp($_);
   next if $. == 1;
 
-  # remove features that compare to the gold parse tree
+  # remove the parse counts (there are no gold parse tree fields)
   s/[GNPW]=\d+\s+/ /g;
 
   # remove the score
@@ -193,6 +184,4 @@ if (! $undo_map) {
 }
 
 # cleanup
-close($goldfh);
-close($parsefh);
-map { unlink($_); } ($featurefilename,$mapfilename,$goldfilename,$parsefilename);
+map { unlink($_); } ($featurefilename,$mapfilename,$parsefilename);
@@ -0,0 +1,179 @@
+// feature-dictionary.cc
+//
+// The out-of-line parts of shared_feature_dictionary{}: hashing,
+// insertion, clearing, purging and rehashing.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+#include "feature-dictionary.h"
+
+bool shared_feature_dictionary::enabled = false;
+const size_t shared_feature_dictionary::npos;
+const unsigned shared_feature_dictionary::empty_class;
+const unsigned shared_feature_dictionary::erased_class;
+
+//! The table is grown when more than max_load_num/max_load_den of its
+//! slots are live or tombstones.
+//
+static const size_t max_load_num = 7, max_load_den = 10;
+
+shared_feature_dictionary& shared_feature_dictionary::global() {
+  static shared_feature_dictionary sd;
+  return sd;
+}  // shared_feature_dictionary::global()
+
+shared_feature_dictionary::shared_feature_dictionary()
+  : nlive(0), nerased(0), nerased_bytes(0), min_capacity(0) { }
+
+//! hash() mixes the key 8 bytes at a time, then finishes with the
+//! MurmurHash3 64-bit finalizer so that every bit of the result
+//! depends on every bit of the key (symbols are pointers, whose low
+//! bits are always zero).
+//
+unsigned shared_feature_dictionary::hash(unsigned cls, const char* key, size_t len) {
+  unsigned long long h = 0x9e3779b97f4a7c15ULL * (cls + 1) ^ len;
+  for (; len >= 8; key += 8, len -= 8) {
+    unsigned long long w;
+    memcpy(&w, key, 8);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+  if (len > 0) {
+    unsigned long long w = 0;
+    memcpy(&w, key, len);
+    h = (h ^ w) * 0xff51afd7ed558ccdULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return unsigned(h);
+}  // shared_feature_dictionary::hash()
+
+unsigned shared_feature_dictionary::new_class() {
+  class_slots.push_back(std::vector<unsigned>());
+  class_size.push_back(0);
+  return class_slots.size() - 1;
+}  // shared_feature_dictionary::new_class()
+
+unsigned key_arena::add(const char* key, size_t len) {
+  if (len > block_size) {
+    std::cerr << "## Error in key_arena::add(): feature of " << len 
+	      << " bytes is longer than a block" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if ((nused & (block_size-1)) + len > block_size)   // start a new block
+    nused = (nused | (block_size-1)) + 1;
+  if ((nused >> block_bits) == blocks.size()) {
+    if (blocks.size() == (size_t(1) << (32 - block_bits))) {
+      std::cerr << "## Error in key_arena::add(): more than 4Gb of features" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    blocks.push_back(new char[block_size]);
+  }
+  unsigned offset = nused;
+  memcpy(blocks[offset >> block_bits] + (offset & (block_size-1)), key, len);
+  nused += len;
+  return offset;
+}  // key_arena::add()
+
+void key_arena::clear() {
+  foreach (std::vector<char*>, it, blocks)
+    delete[] *it;
+  blocks.clear();
+  nused = 0;
+}  // key_arena::clear()
+
+//! capacity_for() is the smallest table size that holds n entries
+//
+static size_t capacity_for(size_t n) {
+  return std::max(size_t(16), n*max_load_den/max_load_num + 1);
+}  // capacity_for()
+
+void shared_feature_dictionary::reserve(size_t n) {
+  min_capacity = capacity_for(n);
+  if (min_capacity > table.size())
+    rehash(min_capacity);
+}  // shared_feature_dictionary::reserve()
+
+size_t shared_feature_dictionary::insert(unsigned cls, const char* key, size_t len,
+					 unsigned h, Id id) {
+  if ((nlive + nerased + 1)*max_load_den > table.size()*max_load_num) {
+    size_t capacity = capacity_for(nlive + 1);
+    if (nerased <= nlive)   // double, unless it's mostly tombstones
+      capacity = std::max(capacity, 2*table.size());
+    rehash(std::max(capacity, min_capacity));
+  }
+  size_t i = home(h);
+  while (table[i].cls != empty_class)
+    i = next(i);
+  entry& e = table[i];
+  e.hash = h;
+  e.cls = cls;
+  e.offset = arena.add(key, len);
+  e.length = len;
+  e.value = id;
+  class_slots[cls].push_back(i);
+  ++class_size[cls];
+  ++nlive;
+  return i;
+}  // shared_feature_dictionary::insert()
+
+void shared_feature_dictionary::clear(unsigned cls) {
+  cforeach (std::vector<unsigned>, it, class_slots[cls])
+    if (table[*it].cls == cls)
+      erase(*it);
+  std::vector<unsigned>().swap(class_slots[cls]);
+}  // shared_feature_dictionary::clear()
+
+size_t shared_feature_dictionary::bytes(unsigned cls) const {
+  size_t n = class_slots[cls].capacity()*sizeof(unsigned);
+  if (nlive > 0)
+    n += class_size[cls]*table.size()*sizeof(entry)/nlive;
+  cforeach (std::vector<unsigned>, it, class_slots[cls])
+    if (table[*it].cls == cls)
+      n += table[*it].length;
+  return n;
+}  // shared_feature_dictionary::bytes()
+
+void shared_feature_dictionary::compact() {
+  min_capacity = 0;
+  rehash(capacity_for(nlive));
+}  // shared_feature_dictionary::compact()
+
+void shared_feature_dictionary::purge() {
+  if (nerased > 0 && (nlive + nerased)*max_load_den > table.size()*max_load_num)
+    rehash(table.size());
+}  // shared_feature_dictionary::purge()
+
+//! rehash() rebuilds the table with capacity slots,
+//! dropping the tombstones and the keys of erased entries
+//
+void shared_feature_dictionary::rehash(size_t capacity) {
+  std::vector<entry> old_table(capacity);
+  old_table.swap(table);
+  key_arena old_arena;
+  bool compact_arena = 2*nerased_bytes > arena.used();
+  if (compact_arena) {
+    old_arena.swap(arena);
+    nerased_bytes = 0;
+  }
+  nerased = 0;
+  foreach (std::vector<std::vector<unsigned> >, it, class_slots)
+    it->clear();
+
+  cforeach (std::vector<entry>, it, old_table)
+    if (it->cls < erased_class) {
+      size_t i = home(it->hash);
+      while (table[i].cls != empty_class)
+	i = next(i);
+      entry& e = table[i];
+      e = *it;
+      if (compact_arena)
+	e.offset = arena.add(old_arena.at(it->offset), it->length);
+      class_slots[e.cls].push_back(i);
+    }
+}  // shared_feature_dictionary::rehash()
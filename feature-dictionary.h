@@ -0,0 +1,482 @@
+// feature-dictionary.h -- maps from a feature class's features to their Ids
+//
+// feature_dictionary<Feature>{} is the map each FeatureClass keeps from
+// its features to their Ids (or, while counting, to their counts).
+// By default it is an ext::hash_map of its own.  If
+// shared_feature_dictionary::enabled is set when it is constructed,
+// its entries live instead in the one shared_feature_dictionary{},
+// tagged with the index of the class they belong to, and its features
+// are stored serialized in the shared dictionary's byte arena.  This
+// saves the bucket array and the per-node allocations of ~100 separate
+// hash_maps, and the shared table can be sized once for the whole
+// feature set with reserve().
+//
+// key_buffer{}                  a byte buffer features are serialized into
+// encode_key(), decode_key()    serialize and deserialize features
+// shared_feature_dictionary{}   the class-tagged open-addressing table
+// feature_dictionary<Feature>{} the per-class dictionary
+//
+// A feature type can be stored in the shared dictionary if it is built
+// out of ints, symbols, sstrings, std::vectors and std::pairs.
+//
+// The shared dictionary is not locked: any number of threads may
+// find() features concurrently, but insert(), erase() and clear() on
+// any class must not run concurrently with other accesses.
+
+#ifndef FEATURE_DICTIONARY_H
+#define FEATURE_DICTIONARY_H
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "sstring.h"
+#include "sym.h"
+#include "utility.h"
+
+typedef unsigned int feature_dictionary_id;   //!< same as Id in spfeatures.h
+
+//! key_buffer{} holds a serialized feature.  Short keys (the usual case)
+//! are kept inline, so serializing a feature for a lookup doesn't
+//! allocate.
+//
+class key_buffer {
+  enum { inline_size = 256 };
+  char inline_data[inline_size];
+  std::vector<char> overflow;
+  size_t n;
+
+public:
+  key_buffer() : n(0) { }
+
+  const char* data() const { return overflow.empty() ? inline_data : &overflow[0]; }
+  size_t size() const { return n; }
+
+  void append(const void* p, size_t len) {
+    const char* cp = static_cast<const char*>(p);
+    if (overflow.empty() && n + len <= inline_size)
+      memcpy(inline_data + n, cp, len);
+    else {
+      if (overflow.empty())
+	overflow.assign(inline_data, inline_data + n);
+      overflow.insert(overflow.end(), cp, cp + len);
+    }
+    n += len;
+  }  // key_buffer::append()
+};  // key_buffer{}
+
+// the templates are declared first so that they can call each other
+
+template <typename T1, typename T2>
+inline void encode_key(key_buffer& buf, const std::pair<T1,T2>& p);
+template <typename T>
+inline void encode_key(key_buffer& buf, const std::vector<T>& xs);
+template <typename T1, typename T2>
+inline void decode_key(const char*& p, std::pair<T1,T2>& x);
+template <typename T>
+inline void decode_key(const char*& p, std::vector<T>& xs);
+
+//! encode_key() appends the serialization of a feature to buf
+//
+inline void encode_key(key_buffer& buf, int x) { buf.append(&x, sizeof x); }
+
+inline void encode_key(key_buffer& buf, symbol s) {
+  const std::string* sp = s.string_pointer();
+  buf.append(&sp, sizeof sp);
+}
+
+inline void encode_key(key_buffer& buf, const sstring& s) {
+  unsigned len = s.size();
+  buf.append(&len, sizeof len);
+  buf.append(s.data(), len);
+}
+
+template <typename T1, typename T2>
+inline void encode_key(key_buffer& buf, const std::pair<T1,T2>& p) {
+  encode_key(buf, p.first);
+  encode_key(buf, p.second);
+}
+
+template <typename T>
+inline void encode_key(key_buffer& buf, const std::vector<T>& xs) {
+  unsigned len = xs.size();
+  buf.append(&len, sizeof len);
+  cforeach (typename std::vector<T>, it, xs)
+    encode_key(buf, *it);
+}
+
+//! decode_key() reads a feature serialized by encode_key() from p,
+//! advancing p past it
+//
+inline void decode_key(const char*& p, int& x) { memcpy(&x, p, sizeof x); p += sizeof x; }
+
+inline void decode_key(const char*& p, symbol& s) {
+  const std::string* sp;
+  memcpy(&sp, p, sizeof sp);
+  p += sizeof sp;
+  s = symbol::from_string_pointer(sp);
+}
+
+inline void decode_key(const char*& p, sstring& s) {
+  unsigned len;
+  memcpy(&len, p, sizeof len);
+  p += sizeof len;
+  s.assign(p, len);
+  p += len;
+}
+
+template <typename T1, typename T2>
+inline void decode_key(const char*& p, std::pair<T1,T2>& x) {
+  decode_key(p, x.first);
+  decode_key(p, x.second);
+}
+
+template <typename T>
+inline void decode_key(const char*& p, std::vector<T>& xs) {
+  unsigned len;
+  memcpy(&len, p, sizeof len);
+  p += sizeof len;
+  xs.resize(len);
+  foreach (typename std::vector<T>, it, xs)
+    decode_key(p, *it);
+}
+
+//! key_arena{} stores serialized features in 1Mb blocks, so that it
+//! grows without copying.  A key is identified by its offset, and never
+//! straddles two blocks.
+//
+class key_arena {
+  enum { block_bits = 20, block_size = 1 << block_bits };
+  std::vector<char*> blocks;
+  size_t nused;     //!< offset of the next key
+
+  key_arena(const key_arena&);              // not copyable
+  key_arena& operator= (const key_arena&);
+
+public:
+  key_arena() : nused(0) { }
+  ~key_arena() { clear(); }
+
+  const char* at(unsigned offset) const {
+    return blocks[offset >> block_bits] + (offset & (block_size-1));
+  }
+
+  //! add() copies key into the arena and returns its offset
+  //
+  unsigned add(const char* key, size_t len);
+
+  size_t used() const { return nused; }
+  size_t bytes() const { return blocks.size()*block_size; }
+
+  void clear();
+  void swap(key_arena& a) { blocks.swap(a.blocks); std::swap(nused, a.nused); }
+};  // key_arena{}
+
+
+//! shared_feature_dictionary{} is a linear-probing hash table from
+//! (class index, serialized feature) to Id.  The serialized features
+//! are kept in one key_arena; erased entries are left as tombstones
+//! until the table is next rehashed, which also compacts the arena if
+//! most of it belongs to erased entries.  Each
+//! class's slots are listed in class_slots so that a class's entries
+//! can be enumerated without scanning the whole table.
+//
+class shared_feature_dictionary {
+public:
+  typedef feature_dictionary_id Id;
+
+  static bool enabled;   //!< feature_dictionaries constructed now are shared
+
+  //! global() is the dictionary every shared feature_dictionary uses
+  //
+  static shared_feature_dictionary& global();
+
+  static const size_t npos = size_t(-1);
+
+  //! hash() returns the hash of a serialized feature of class cls
+  //
+  static unsigned hash(unsigned cls, const char* key, size_t len);
+
+  shared_feature_dictionary();
+
+private:
+  shared_feature_dictionary(const shared_feature_dictionary&);   // not copyable
+  shared_feature_dictionary& operator= (const shared_feature_dictionary&);
+
+public:
+
+  //! new_class() returns the index of a new, empty class
+  //
+  unsigned new_class();
+
+  //! reserve() sizes the table to hold n entries without rehashing;
+  //! it is never shrunk below this
+  //
+  void reserve(size_t n);
+
+  //! find() returns the slot of the entry for key in class cls, or npos
+  //
+  size_t find(unsigned cls, const char* key, size_t len, unsigned h) const {
+    if (table.empty())
+      return npos;
+    for (size_t i = home(h); ; i = next(i)) {
+      const entry& e = table[i];
+      if (e.cls == empty_class)
+	return npos;
+      if (e.hash == h && e.cls == cls && e.length == len
+	  && memcmp(arena.at(e.offset), key, len) == 0)
+	return i;
+    }
+  }  // shared_feature_dictionary::find()
+
+  //! insert() adds an entry for key (which must not already be present)
+  //! in class cls with value id, and returns its slot
+  //
+  size_t insert(unsigned cls, const char* key, size_t len, unsigned h, Id id);
+
+  //! erase() removes the entry in slot i
+  //
+  void erase(size_t i) {
+    assert(table[i].cls < erased_class);
+    --class_size[table[i].cls];
+    table[i].cls = erased_class;
+    --nlive;
+    ++nerased;
+    nerased_bytes += table[i].length;
+  }  // shared_feature_dictionary::erase()
+
+  //! clear() removes every entry of class cls
+  //
+  void clear(unsigned cls);
+
+  //! bytes() approximates the memory used by class cls's entries:
+  //! their share of the table, their slot list and their keys
+  //
+  size_t bytes(unsigned cls) const;
+
+  Id& value(size_t i) { return table[i].value; }
+  const Id& value(size_t i) const { return table[i].value; }
+  const char* key(size_t i) const { return arena.at(table[i].offset); }
+  bool live(unsigned cls, size_t i) const { return table[i].cls == cls; }
+  size_t size(unsigned cls) const { return class_size[cls]; }
+  const std::vector<unsigned>& slots(unsigned cls) const { return class_slots[cls]; }
+  size_t capacity() const { return table.size(); }
+  size_t arena_bytes() const { return arena.bytes(); }
+
+  //! compact() shrinks the table to fit its live entries (dropping any
+  //! size set by reserve()), e.g. once the features have been pruned
+  //
+  void compact();
+
+  //! purge() rehashes the table at its current size, dropping the
+  //! tombstones, once they take it past its maximum load; a class
+  //! that erases entries as it counts calls it so that the tombstones
+  //! don't make the table grow or lengthen its probe sequences
+  //
+  void purge();
+
+private:
+  static const unsigned empty_class = unsigned(-1);
+  static const unsigned erased_class = unsigned(-2);
+
+  struct entry {
+    unsigned hash;     //!< hash of cls and key
+    unsigned cls;      //!< class index, empty_class or erased_class
+    unsigned offset;   //!< position of key in arena
+    unsigned length;   //!< length of key
+    Id value;
+
+    entry() : hash(0), cls(empty_class), offset(0), length(0), value(0) { }
+  };  // shared_feature_dictionary::entry{}
+
+  void rehash(size_t capacity);
+
+  //! home() maps a hash to a slot, by multiplying rather than masking
+  //! so that the table size needn't be a power of 2
+  //
+  size_t home(unsigned h) const { return (unsigned long long) h * table.size() >> 32; }
+  size_t next(size_t i) const { return ++i == table.size() ? 0 : i; }
+
+  std::vector<entry> table;
+  size_t nlive;            //!< entries in use
+  size_t nerased;          //!< tombstones
+  size_t nerased_bytes;    //!< arena bytes belonging to erased entries
+  size_t min_capacity;     //!< set by reserve()
+  key_arena arena;
+  std::vector<std::vector<unsigned> > class_slots;
+  std::vector<size_t> class_size;
+};  // shared_feature_dictionary{}
+
+
+//! feature_dictionary<Feature>{} maps the features of one class to
+//! their Ids, either in a hash_map of its own or in the shared
+//! dictionary.  find() returns a pointer to a feature's Id (or NULL);
+//! iterators enumerate the entries, with key() returning a copy of the
+//! feature and id() a reference to its Id.
+//
+template <typename Feature>
+class feature_dictionary {
+public:
+  typedef feature_dictionary_id Id;
+  typedef ext::hash_map<Feature,Id> Map;
+
+  feature_dictionary()
+    : sd(shared_feature_dictionary::enabled ? &shared_feature_dictionary::global() : NULL),
+      cls(sd ? sd->new_class() : 0), local(sd ? 0 : 100) { }
+
+  ~feature_dictionary() {
+    if (sd)
+      sd->clear(cls);
+  }
+
+  bool shared() const { return sd != NULL; }
+
+  class iterator;
+  class const_iterator;
+
+  //! iterator{} enumerates the entries of a feature_dictionary
+  //
+  class iterator {
+    friend class feature_dictionary;
+    friend class const_iterator;
+    feature_dictionary* d;
+    typename Map::iterator mit;   //!< position in d->local
+    size_t i;                     //!< position in d's slot list
+
+    iterator(feature_dictionary* d, typename Map::iterator mit, size_t i)
+      : d(d), mit(mit), i(i) { skip(); }
+
+    void skip() {
+      if (d->sd)
+	while (i < d->sd->slots(d->cls).size() && !d->sd->live(d->cls, slot()))
+	  ++i;
+    }
+    size_t slot() const { return d->sd->slots(d->cls)[i]; }
+
+  public:
+    iterator() : d(NULL), i(0) { }
+
+    Feature key() const {
+      if (!d->sd)
+	return mit->first;
+      Feature f;
+      const char* p = d->sd->key(slot());
+      decode_key(p, f);
+      return f;
+    }
+    Id& id() const { return d->sd ? d->sd->value(slot()) : mit->second; }
+
+    iterator& operator++ () {
+      if (d->sd) {
+	++i;
+	skip();
+      }
+      else
+	++mit;
+      return *this;
+    }
+    iterator operator++ (int) { iterator it(*this); ++*this; return it; }
+    bool operator== (const iterator& it) const { return d->sd ? i == it.i : mit == it.mit; }
+    bool operator!= (const iterator& it) const { return !(*this == it); }
+  };  // feature_dictionary::iterator{}
+
+  //! const_iterator{} enumerates the entries of a const feature_dictionary
+  //
+  class const_iterator {
+    iterator it;
+  public:
+    const_iterator() { }
+    const_iterator(const iterator& it) : it(it) { }
+    Feature key() const { return it.key(); }
+    const Id& id() const { return it.id(); }
+    const_iterator& operator++ () { ++it; return *this; }
+    const_iterator operator++ (int) { const_iterator cit(*this); ++it; return cit; }
+    bool operator== (const const_iterator& cit) const { return it == cit.it; }
+    bool operator!= (const const_iterator& cit) const { return it != cit.it; }
+  };  // feature_dictionary::const_iterator{}
+
+  iterator begin() { return iterator(this, local.begin(), 0); }
+  iterator end() { return iterator(this, local.end(), sd ? sd->slots(cls).size() : 0); }
+  const_iterator begin() const { return const_cast<feature_dictionary*>(this)->begin(); }
+  const_iterator end() const { return const_cast<feature_dictionary*>(this)->end(); }
+
+  //! find() returns a pointer to f's Id, or NULL if f isn't present
+  //
+  Id* find(const Feature& f) {
+    if (!sd) {
+      typename Map::iterator it = local.find(f);
+      return it == local.end() ? NULL : &it->second;
+    }
+    key_buffer buf;
+    encode_key(buf, f);
+    size_t i = sd->find(cls, buf.data(), buf.size(),
+			shared_feature_dictionary::hash(cls, buf.data(), buf.size()));
+    return i == shared_feature_dictionary::npos ? NULL : &sd->value(i);
+  }  // feature_dictionary::find()
+
+  const Id* find(const Feature& f) const {
+    return const_cast<feature_dictionary*>(this)->find(f);
+  }
+
+  //! insert() adds f with Id id, returning false (and changing
+  //! nothing) if f is already present
+  //
+  bool insert(const Feature& f, Id id) {
+    if (!sd)
+      return local.insert(typename Map::value_type(f, id)).second;
+    key_buffer buf;
+    encode_key(buf, f);
+    unsigned h = shared_feature_dictionary::hash(cls, buf.data(), buf.size());
+    if (sd->find(cls, buf.data(), buf.size(), h) != shared_feature_dictionary::npos)
+      return false;
+    sd->insert(cls, buf.data(), buf.size(), h, id);
+    return true;
+  }  // feature_dictionary::insert()
+
+  //! erase() removes the entry at it; other iterators stay valid
+  //
+  void erase(iterator it) {
+    if (sd)
+      sd->erase(it.slot());
+    else
+      local.erase(it.mit);
+  }  // feature_dictionary::erase()
+
+  //! purge() drops the shared dictionary's tombstones if there are
+  //! enough of them (see shared_feature_dictionary::purge()); it
+  //! invalidates iterators
+  //
+  void purge() {
+    if (sd)
+      sd->purge();
+  }  // feature_dictionary::purge()
+
+  size_t size() const { return sd ? sd->size(cls) : local.size(); }
+  bool empty() const { return size() == 0; }
+
+  void clear() {
+    if (sd)
+      sd->clear(cls);
+    else
+      local.clear();
+  }  // feature_dictionary::clear()
+
+  //! bucket_count() is the size of the hash_map's bucket array (0 if shared)
+  //
+  size_t bucket_count() const { return sd ? 0 : local.bucket_count(); }
+
+  //! shared_bytes() approximates the shared dictionary memory used by this class
+  //
+  size_t shared_bytes() const { return sd ? sd->bytes(cls) : 0; }
+
+private:
+  feature_dictionary(const feature_dictionary&);             // not copyable
+  feature_dictionary& operator= (const feature_dictionary&);
+
+  shared_feature_dictionary* sd;   //!< NULL unless shared
+  unsigned cls;                    //!< class index in *sd
+  Map local;                       //!< the entries, unless shared
+};  // feature_dictionary{}
+
+#endif  // FEATURE_DICTIONARY_H
@@ -0,0 +1,107 @@
+/* libspfeatures.h -- in-process feature extraction API
+ *
+ * libspfeatures.a contains the feature extraction engine used by
+ * extract-spfeatures.  This header is its API, which can be called
+ * from C or C++ (link with a C++ compiler, since the library uses
+ * the C++ runtime).
+ *
+ * A typical caller opens an extractor once with the feature map
+ * written by extract-spfeatures (the "<id> TAB <class> <feature>"
+ * lines on its standard output), and then calls spf_extract() for
+ * each n-best list:
+ *
+ *   spf_extractor* e = spf_open(NULL, "features.map", 0);
+ *   long n = spf_extract(e, nparses, trees, logprobs,
+ *                        ids, values, offsets, capacity);
+ *   if (n > capacity) { ... grow ids and values, and call again ... }
+ *   ...
+ *   spf_close(e);
+ *
+ * Feature values are computed exactly as extract-spfeatures computes
+ * them for its feature files.  The pairs for parse j are
+ * ids[offsets[j]] ... ids[offsets[j+1]-1] (and similarly for values),
+ * sorted by id.
+ *
+ * An extractor must only be used by one thread at a time.  Whether
+ * counts are absolute is process-wide state, so the extractors open
+ * at any one time must agree on SPF_ABSOLUTE_COUNTS.
+ */
+
+#ifndef LIBSPFEATURES_H
+#define LIBSPFEATURES_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* flags for spf_open() */
+
+#define SPF_ABSOLUTE_COUNTS  1  /* absolute rather than relative feature counts (-a) */
+#define SPF_LOWERCASE        2  /* map all words to lower case (-l) */
+
+typedef unsigned int spf_id;
+typedef struct spf_extractor spf_extractor;
+
+/* spf_open() creates an extractor for the feature set featureset
+ * (NULL, "local", "sp", "spnn" or a list of feature class patterns
+ * such as "Rule:0:*,Edges:1:*", as for extract-spfeatures -f)
+ * using the feature map in the file featuremap.  It returns NULL
+ * on failure (including a malformed feature map, or SPF_ABSOLUTE_COUNTS
+ * set differently than for the extractors already open), and then
+ * spf_error(NULL) says why.
+ */
+spf_extractor* spf_open(const char* featureset, const char* featuremap, int flags);
+
+/* spf_close() frees an extractor */
+void spf_close(spf_extractor* e);
+
+/* spf_maxid() returns one more than the largest feature id in the map */
+spf_id spf_maxid(const spf_extractor* e);
+
+/* spf_extract() computes the features of the nparses parses of a
+ * sentence.  trees[j] is the j'th parse in Penn treebank format and
+ * logprobs[j] its parser log probability.  offsets must have room for
+ * nparses+1 entries, and ids and values for capacity entries.
+ *
+ * It returns the number of (id, value) pairs for the sentence, or -1
+ * on error, e.g., a tree that can't be read or a logprob that isn't
+ * finite (see spf_error()).  If that is more than capacity only
+ * offsets is filled in, and the call should be repeated with larger
+ * buffers.
+ */
+long spf_extract(spf_extractor* e, size_t nparses,
+		 const char* const* trees, const double* logprobs,
+		 spf_id* ids, double* values, size_t* offsets, size_t capacity);
+
+/* spf_error() returns a description of e's last error, or "".
+ * spf_error(NULL) describes why the calling thread's last spf_open()
+ * failed.
+ */
+const char* spf_error(const spf_extractor* e);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+
+#include "sp-data.h"
+
+/* C++ callers that already have their parses in memory can use the
+ * following instead of parsing strings.
+ */
+
+/* spf_read_sptree() reads an sptree from a Penn treebank format string,
+ * returning NULL if str isn't a tree.  The caller owns the tree.
+ */
+sptree* spf_read_sptree(const char* str, bool lowercase = false);
+
+/* spf_extract_sentence() is spf_extract() on a sentence whose parses
+ * (with their logprob and parse members) are already set; it sets
+ * their logcondprobs.
+ */
+long spf_extract_sentence(spf_extractor* e, sp_sentence_type& sentence,
+			  spf_id* ids, double* values, size_t* offsets, size_t capacity);
+
+#endif  /* __cplusplus */
+
+#endif  /* LIBSPFEATURES_H */
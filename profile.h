@@ -0,0 +1,137 @@
+// profile.h
+//
+// Profiling support for feature extraction.  Each FeatureClass owns a
+// featureclass_profile{} which FeatureClassPtrs fills in when profiling
+// is turned on; write_profile() prints them as a table keyed by
+// FeatureClass::identifier().
+//
+// wall_time()             seconds on a monotonic clock
+// cpu_time()              CPU seconds used by the calling thread
+// profile_counter{}       accumulated calls, wall and CPU time
+// profile_scope{}         adds the time of a scope to a profile_counter
+// featureclass_profile{}  counters kept by every FeatureClass
+// phase_stats{}           sentence and parse throughput of a phase
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstddef>
+#include <ctime>
+#include <iostream>
+
+#include "alloc-tracker.h"
+
+//! wall_time() returns the time in seconds since some fixed point
+//
+inline double wall_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}  // wall_time()
+
+//! cpu_time() returns the CPU time in seconds used by the calling thread
+//
+inline double cpu_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}  // cpu_time()
+
+//! profile_counter{} accumulates the number of calls and the wall
+//! and CPU time they took.
+//
+struct profile_counter {
+  size_t calls;
+  double wall;
+  double cpu;
+
+  profile_counter() : calls(0), wall(0), cpu(0) { }
+};  // profile_counter{}
+
+//! profile_scope{} adds the wall and CPU time between its construction
+//! and destruction to a profile_counter.
+//
+struct profile_scope {
+  profile_counter& counter;
+  double wall0, cpu0;
+
+  profile_scope(profile_counter& counter)
+    : counter(counter), wall0(wall_time()), cpu0(cpu_time()) { }
+
+  ~profile_scope() {
+    ++counter.calls;
+    counter.wall += wall_time() - wall0;
+    counter.cpu += cpu_time() - cpu0;
+  }
+};  // profile_scope{}
+
+//! featureclass_profile{} holds the profiling counters of a FeatureClass.
+//
+struct featureclass_profile {
+  profile_counter extract;    //!< extract_features() calls
+  profile_counter values;     //!< feature_values() calls
+  profile_counter prune;      //!< prune_and_renumber() calls
+  size_t ngenerated;          //!< (feature, parse) pairs seen while counting
+  size_t ndistinct;           //!< distinct features before pruning
+  size_t nkept;               //!< features surviving pruning
+  size_t nbytes_counted;      //!< approximate dictionary bytes before pruning
+  alloc_counter extract_allocs;  //!< allocations in extract_features()
+  alloc_counter values_allocs;   //!< allocations in feature_values()
+
+  featureclass_profile()
+    : ngenerated(0), ndistinct(0), nkept(0), nbytes_counted(0) { }
+
+  double wall() const { return extract.wall + values.wall + prune.wall; }
+};  // featureclass_profile{}
+
+//! phase_stats{} counts the sentences and parses processed in a
+//! phase (counting, pruning, writing a data set) and reports them
+//! together with the throughput since the phase started.
+//
+struct phase_stats {
+  const char* name;
+  size_t nsentences;
+  size_t nparses;
+  size_t nduplicates;     //!< parses whose tree duplicates an earlier parse's
+  double wall0;
+  double wall1;           //!< when stop() was called, or 0 if still running
+  alloc_counter allocs;   //!< allocations, when tracking is on
+
+  phase_stats(const char* name = "") { start(name); }
+
+  void start(const char* phasename) {
+    name = phasename;
+    nsentences = nparses = nduplicates = 0;
+    wall0 = wall_time();
+    wall1 = 0;
+    allocs = alloc_counter();
+  }
+
+  //! stop() freezes elapsed(), for a phase that is reported later
+  //
+  void stop() { wall1 = wall_time(); }
+
+  double elapsed() const { return (wall1 > 0 ? wall1 : wall_time()) - wall0; }
+};  // phase_stats{}
+
+inline std::ostream& operator<< (std::ostream& os, const phase_stats& ps) {
+  double secs = ps.elapsed();
+  os << ps.name << " " << secs << "s";
+  if (ps.nsentences > 0) {
+    os << ", " << ps.nsentences << " sentences, " << ps.nparses << " parses";
+    if (secs > 0)
+      os << " (" << ps.nsentences/secs << " sentences/s, "
+	 << ps.nparses/secs << " parses/s)";
+    if (ps.nduplicates > 0)
+      os << ", " << ps.nduplicates << " duplicate parses collapsed";
+  }
+  if (alloc_tracker::enabled) {
+    os << ", " << ps.allocs.nallocs << " allocs, " << ps.allocs.nbytes/1048576.0 
+       << " Mb allocated, " << ps.allocs.nnodes << " tree nodes";
+    if (ps.nsentences > 0)
+      os << " (" << double(ps.allocs.nallocs)/ps.nsentences << " allocs/sentence)";
+  }
+  return os;
+}  // operator<<(phase_stats)
+
+#endif // PROFILE_H
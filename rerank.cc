@@ -0,0 +1,253 @@
+// rerank.cc -- rerank n-best parses with a trained feature weight vector
+//
+// rerank reads a feature map (as written by extract-spfeatures) and a
+// weight vector once, then streams n-best lists from stdin through a
+// pool of worker threads, writing the best parse (or the reranked
+// n-best list) for each sentence to stdout in input order.
+
+const char usage[] =
+"Usage:\n"
+"\n"
+"rerank [-a] [-b <b>] [-d] [-f <f>] [-j <j>] [-l] [-r] [-u] featuremap weights < nbest > parses\n"
+"\n"
+"where:\n"
+" -a uses absolute feature counts (use this if the features were extracted with -a),\n"
+" -b <b> is the number of sentences handed to the workers at a time (default 64 per thread),\n"
+" -d keeps every feature class's features in one shared table rather than a\n"
+"    hash table per class,\n"
+" -f <f> uses feature classes <f>: local, sp, spnn, a list of identifier patterns\n"
+"    such as \"Rule:0:*,Edges:1:*\" or \"*,!NGramTree:*\", or @file, as for\n"
+"    extract-spfeatures (must be the feature set used to write featuremap),\n"
+" -j <j> is the number of worker threads (default 1; 0 uses one per processor),\n"
+" -l maps all words to lower case as trees are read,\n"
+" -r writes each n-best list reranked (score, logprob and tree per parse)\n"
+"    rather than just the best parse,\n"
+" -u scores each parse by summing its feature values rather than scoring it\n"
+"    directly (slower; make check compares the two),\n"
+"\n"
+" featuremap is the feature map written by extract-spfeatures to standard output,\n"
+" weights is a file of feature weights, each either \"<id>=<weight>\" or \"<id> <weight>\";\n"
+"    features without a weight have weight 0, and are never computed.\n"
+"\n"
+"The n-best lists on stdin are in the format written by Charniak's n-best parser,\n"
+"i.e., \"<nparses> <label>\" followed by \"<logprob>\" and <tree> for each parse.\n"
+"The sentences/s rate is written to stderr.\n";
+
+#include "custom_allocator.h"       // must be first
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "features.h"
+#include "profile.h"
+#include "sp-data.h"
+#include "thread-pool.h"
+#include "utility.h"
+
+//! read_weights() reads a weights file into ws, which is resized to
+//! have an entry for every id up to maxid.
+//
+static void read_weights(const char* filename, Id maxid, Floats& ws) {
+  FILE* fp = fopen(filename, "r");
+  if (fp == NULL) {
+    std::cerr << "## Error: can't open weights file " << filename << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  ws.assign(maxid+1, 0);
+  unsigned id;
+  double w;
+  char sep;
+  while (fscanf(fp, " %u%c", &id, &sep) == 2) {
+    if (sep != '=' && !isspace(sep)) {
+      std::cerr << "## Error: bad separator '" << sep << "' after id " << id
+		<< " in weights file " << filename << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (fscanf(fp, " %lf", &w) != 1) {
+      std::cerr << "## Error: can't read weight of id " << id
+		<< " in weights file " << filename << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (id >= ws.size())
+      ws.resize(id+1, 0);
+    ws[id] = w;
+  }
+  if (!feof(fp)) {
+    std::cerr << "## Error: can't parse weights file " << filename << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+}  // read_weights()
+
+//! rerank_task{} reranks one sentence, leaving the text to be written in output
+//
+struct rerank_task : public thread_pool::task {
+  const FeatureClassPtrs& fcps;
+  const Floats& ws;
+  bool ranked;
+  bool fused;
+  sp_sentence_type sentence;
+  std::string output;
+
+  rerank_task(const FeatureClassPtrs& fcps, const Floats& ws, bool ranked, bool fused)
+    : fcps(fcps), ws(ws), ranked(ranked), fused(fused) { }
+
+  virtual void run() {
+    std::ostringstream os;
+    if (ranked)
+      fcps.write_ranked_trees(sentence, ws, os, fused);
+    else {
+      write_tree_noquote_root(os, fcps.best_parse(sentence, ws, fused));
+      os << '\n';
+    }
+    output = os.str();
+  }  // rerank_task::run()
+};  // rerank_task{}
+
+typedef std::vector<rerank_task*> rerank_tasks;
+
+//! read_batch() reads up to tasks.size() sentences from is into tasks,
+//! returning the number read.  nread counts the sentences read so far.
+//! It exits with an error if is holds anything but n-best lists, so
+//! that a bad n-best list isn't taken for the end of the input.
+//
+static size_t read_batch(std::istream& is, rerank_tasks& tasks, size_t& nread) {
+  size_t n = 0;
+  while (n < tasks.size() && (is >> std::ws).peek() != EOF) {
+    if (!tasks[n]->sentence.read_ec_nbest_15aug05(is, lowercase_flag)) {
+      std::cerr << "## Error reading n-best list " << nread+1 << " from stdin" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    ++n;
+    ++nread;
+  }
+  if (is.bad()) {
+    std::cerr << "## Error reading stdin after n-best list " << nread << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return n;
+}  // read_batch()
+
+int main(int argc, char **argv) {
+
+  std::ios::sync_with_stdio(false);
+
+  const char* fcname = NULL;
+  size_t nthreads = 1;
+  size_t batchsize = 0;
+  bool ranked = false;
+  bool fused = true;
+
+  int c;
+  while ((c = getopt(argc, argv, "ab:df:j:lru")) != -1 )
+    switch (c) {
+    case 'a':
+      absolute_counts = true;
+      break;
+    case 'b':
+      batchsize = atoi(optarg);
+      break;
+    case 'd':
+      shared_feature_dictionary::enabled = true;
+      break;
+    case 'f':
+      fcname = optarg;
+      break;
+    case 'j':
+      nthreads = atoi(optarg);
+      break;
+    case 'l':
+      lowercase_flag = true;
+      break;
+    case 'r':
+      ranked = true;
+      break;
+    case 'u':
+      fused = false;
+      break;
+    default:
+      std::cerr << usage << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+  if (argc - optind != 2) {
+    std::cerr << "## Error: missing required arguments.\n" << usage << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (nthreads < 1)
+    nthreads = thread_pool::default_nthreads();
+  if (batchsize < 1)
+    batchsize = 64*nthreads;
+
+  std::cerr
+    << "# featureclasses (-f) = " << (fcname ? fcname : "NULL")
+    << ", absolute_counts (-a) = " << absolute_counts
+    << ", lowercase_flag (-l) = " << lowercase_flag
+    << ", ranked (-r) = " << ranked
+    << ", fused (not -u) = " << fused
+    << ", shared_dictionary (-d) = " << shared_feature_dictionary::enabled
+    << ", nthreads (-j) = " << nthreads
+    << ", batchsize (-b) = " << batchsize
+    << std::endl;
+
+  FeatureClassPtrs fcps(fcname);
+  Id maxid;
+  {
+    std::ifstream is(argv[optind]);
+    if (!is) {
+      std::cerr << "## Error: can't open featuremap " << argv[optind] << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    maxid = fcps.read_feature_ids(is);
+  }
+  Floats ws;
+  read_weights(argv[optind+1], maxid, ws);
+  size_type nclasses = fcps.size();
+  Id nkept = fcps.prune_zero_weights(ws);
+  std::cerr << "# maxid = " << maxid << ", " << nkept << " nonzero-weight features in "
+	    << fcps.size() << " of " << nclasses << " feature classes, usage "
+	    << resource_usage() << std::endl;
+
+  // While the workers rerank one batch the main thread reads the next
+
+  rerank_tasks current(batchsize), next(batchsize);
+  for (size_t i = 0; i < batchsize; ++i) {
+    current[i] = new rerank_task(fcps, ws, ranked, fused);
+    next[i] = new rerank_task(fcps, ws, ranked, fused);
+  }
+
+  phase_stats stats("rerank");
+  {
+    thread_pool pool(nthreads);
+    size_t nread = 0;
+    size_t ncurrent = read_batch(std::cin, current, nread);
+    while (ncurrent > 0) {
+      for (size_t i = 0; i < ncurrent; ++i)
+	pool.submit(current[i]);
+      size_t nnext = read_batch(std::cin, next, nread);
+      pool.wait();
+      for (size_t i = 0; i < ncurrent; ++i) {
+	std::cout << current[i]->output;
+	++stats.nsentences;
+	stats.nparses += current[i]->sentence.nparses();
+	stats.nduplicates += current[i]->sentence.nduplicates;
+      }
+      std::cout << std::flush;
+      current.swap(next);
+      ncurrent = nnext;
+    }
+  }
+
+  std::cerr << "# " << stats << ", usage " << resource_usage() << std::endl;
+
+  for (size_t i = 0; i < batchsize; ++i) {
+    delete current[i];
+    delete next[i];
+  }
+}  // main()
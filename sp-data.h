@@ -10,15 +10,19 @@
 #ifndef SP_DATA_H
 #define SP_DATA_H
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <string>
 #include <vector>
 
 #include "sptree.h"
+#include "trace.h"
 #include "tree.h"
 
 #define BUFSIZE 8000   // size of line buffer
@@ -26,8 +30,9 @@
 typedef double Float;
 #define SCANF_FLOAT_FORMAT "%lf"
 
-// parse_type{} holds the data for a single parse.  It has a pointer
-// to the parse tree, but someone else must free it when it is deleted!
+// parse_type{} holds the data for a single parse.  It owns its trees:
+// copying a parse copies them, and swap() (or, in C++11, moving) a
+// parse hands them over without copying.
 //
 struct sp_parse_type {
   Float logprob;   // log probability from parser
@@ -36,16 +41,71 @@ struct sp_parse_type {
   size_t ncorrect;
   float f_score;   // f-score of this parse
   sptree* parse;
-  tree* parse0;
+  tree* parse0;         // the tree as read, or NULL if read() didn't keep it
+  size_t tree_hash;     // structural hash of parse
+  size_t duplicate_of;  // index of the first parse with the same tree, or unmarked
+
+  // unmarked is duplicate_of until sp_sentence_type::find_duplicate()
+  // has looked at the parse
+  //
+  static const size_t unmarked = size_t(-1);
 
   // default constructor
   //
 sp_parse_type() : logprob(0), logcondprob(0), nedges(0), ncorrect(0),
-	f_score(0), parse(NULL), parse0(NULL) { }
+	f_score(0), parse(NULL), parse0(NULL), tree_hash(0), duplicate_of(unmarked) { }
+
+  // copy constructor
+  //
+sp_parse_type(const sp_parse_type& p) 
+: logprob(p.logprob), logcondprob(p.logcondprob), nedges(p.nedges), 
+  ncorrect(p.ncorrect), f_score(p.f_score), 
+  parse(p.parse ? p.parse->copy_tree() : NULL),
+  parse0(p.parse0 ? p.parse0->copy_tree() : NULL),
+  tree_hash(p.tree_hash), duplicate_of(p.duplicate_of) { }
+
+  // assignment operator
+  //
+  sp_parse_type& operator= (const sp_parse_type& p) {
+    sp_parse_type copy(p);
+    swap(copy);
+    return *this;
+  }  // sp_parse_type::operator=
+
+#if __cplusplus >= 201103L
+  sp_parse_type(sp_parse_type&& p) noexcept 
+  : logprob(0), logcondprob(0), nedges(0), ncorrect(0),
+    f_score(0), parse(NULL), parse0(NULL), tree_hash(0), duplicate_of(unmarked) { swap(p); }
+
+  sp_parse_type& operator= (sp_parse_type&& p) noexcept {
+    swap(p);
+    return *this;
+  }  // sp_parse_type::operator=
+#endif
+
+  ~sp_parse_type() {
+    delete parse;
+    delete parse0;
+  }
+
+  // swap() exchanges the contents of two parses, trees included
+  //
+  void swap(sp_parse_type& p) {
+    std::swap(logprob, p.logprob);
+    std::swap(logcondprob, p.logcondprob);
+    std::swap(nedges, p.nedges);
+    std::swap(ncorrect, p.ncorrect);
+    std::swap(f_score, p.f_score);
+    std::swap(parse, p.parse);
+    std::swap(parse0, p.parse0);
+    std::swap(tree_hash, p.tree_hash);
+    std::swap(duplicate_of, p.duplicate_of);
+  }  // sp_parse_type::swap()
 
   // read() reads from a FILE*, returning true if the read succeeded.
+  // Unless keep_raw_tree, parse0 is deleted once parse is built.
   //
-  bool read(FILE* fp, bool downcase_flag=false) {
+  bool read(FILE* fp, bool downcase_flag=false, bool keep_raw_tree=true) {
 
     int nread = fscanf(fp, " " SCANF_FLOAT_FORMAT " ", &logprob);
     if (nread != 1) {
@@ -73,11 +133,21 @@ sp_parse_type() : logprob(0), logcondprob(0), nedges(0), ncorrect(0),
 				  << "## buffer = " << buffer << std::endl;
 		return false;
       }
-      parse0 = readtree(buffer);
+      {
+	trace_span ts("readtree", "read");
+	parse0 = readtree(buffer);
+      }
       assert(parse0 != NULL);
       parse0->label.cat = tree::label_type::root();
-      parse = tree_sptree(parse0, downcase_flag);
+      {
+	trace_span ts("tree_sptree", "read");
+	parse = tree_sptree(parse0, downcase_flag);
+      }
       // std::cerr << "parse0 = " << parse0 << ", parse = " << parse << std::endl;
+      if (!keep_raw_tree) {
+	delete parse0;
+	parse0 = NULL;
+      }
     }
     return true;
   }  // sp_parse_type::read()
@@ -97,9 +167,11 @@ sp_parse_type() : logprob(0), logcondprob(0), nedges(0), ncorrect(0),
     std::cerr << std::endl;
   }  // sp_parse_type::write_next_thousand_chars()
 
-  //! read_ec_nbest() reads Eugene's n-best parser output
+  //! read_ec_nbest() reads Eugene's n-best parser output; unless
+  //! keep_raw_tree, parse0 is deleted once parse is built
   //
-  std::istream& read_ec_nbest(std::istream& is, bool downcase_flag=false) {
+  std::istream& read_ec_nbest(std::istream& is, bool downcase_flag=false,
+			      bool keep_raw_tree=true) {
     if (is >> logprob >> parse0) {
       if (!finite(logprob)) {
 		std::cerr << "## sp-data.h error reading n-best parses: "
@@ -107,16 +179,24 @@ sp_parse_type() : logprob(0), logcondprob(0), nedges(0), ncorrect(0),
 				  << logprob << ", parse0 = " << parse0 << std::endl;
 		exit(EXIT_FAILURE);
       }      
-      assert(parse0 != NULL);
+      if (parse0 == NULL) {     // e.g., a stray ")"
+	is.setstate(std::ios::failbit);
+	return is;
+      }
       parse0->label.cat = tree::label_type::root();
       parse = tree_sptree(parse0, downcase_flag);
       assert(parse != NULL);
+      if (!keep_raw_tree) {
+	delete parse0;
+	parse0 = NULL;
+      }
     }
     return is;
   }  // read_ec_nbest()
 };  // sp_parse_type{}
 
 
+inline
 std::ostream& operator<< (std::ostream& os, const sp_parse_type& p) {
   return os << "(" << p.logprob << " " << p.logcondprob << " " << p.nedges 
 			<< " " << p.ncorrect << " " << p.parse << ")";
@@ -127,18 +207,33 @@ std::ostream& operator<< (std::ostream& os, const sp_parse_type& p) {
 //
 typedef std::vector<sp_parse_type> sp_parses_type;
 
-// sp_sentence_type{} holds the data for a single sentence.
+// sp_sentence_type{} holds the data for a single sentence, and owns
+// its trees.  Copying a sentence copies every tree in it, so code
+// that passes sentences around should swap() them (or, in C++11, move
+// them) instead, and reuse them: the extract-spfeatures and rerank
+// pipelines each keep two batches of sentences and clear() and reread
+// them rather than allocating new ones.
 //
 struct sp_sentence_type {
   sptree* gold;			// gold standard parse
-  tree* gold0;
+  tree* gold0;                  // NULL unless keep_raw_trees
   size_t gold_nedges;           // number of edges in the gold parse
   float max_fscore;             // the max f-score of all parses
   sp_parses_type parses;	// vector of parses
   size_t nparses() const { return parses.size(); }
+  size_t nduplicates;           // number of parses with the same tree as an earlier one
   Float logsumprob;
   std::string label;
 
+  // keep_raw_trees is true if read() keeps each tree as read (gold0
+  // and each parse's parse0) as well as its sptree.  Only
+  // FeatureClassPtrs::best_parse() and write_ranked_trees() use them,
+  // so feature extraction turns it off.  A tree node is under a third
+  // the size of an sptree node, so this saves about a quarter of a
+  // parse's tree memory, but only a few percent of peak RSS.
+  //
+  bool keep_raw_trees;
+
   //! precrec() increments pr by the score for parse i
   //
   precrec_type& precrec(size_t i, precrec_type& pr) const {
@@ -163,63 +258,77 @@ struct sp_sentence_type {
   // default constructor
   //
 sp_sentence_type() 
-: gold(NULL), gold0(NULL), gold_nedges(0), max_fscore(0), logsumprob(0) { }
+: gold(NULL), gold0(NULL), gold_nedges(0), max_fscore(0), nduplicates(0), logsumprob(0),
+  keep_raw_trees(true) { }
 
   //! destructor
   //
   ~sp_sentence_type() { 
     delete gold;
     delete gold0;
-    foreach (sp_parses_type, it, parses) {
-      delete it->parse;
-      delete it->parse0;
-    }
   }
 
+  //! copy constructor
+  //
+sp_sentence_type(const sp_sentence_type& s) 
+: gold(s.gold ? s.gold->copy_tree() : NULL), 
+  gold0(s.gold0 ? s.gold0->copy_tree() : NULL),
+  gold_nedges(s.gold_nedges), max_fscore(s.max_fscore), parses(s.parses),
+  nduplicates(s.nduplicates), logsumprob(s.logsumprob), label(s.label),
+  keep_raw_trees(s.keep_raw_trees) { }
+
   //! assignment operator
   //
   sp_sentence_type& operator= (const sp_sentence_type& s) {
-    if (this != &s) {
-      gold_nedges = s.gold_nedges;
-      max_fscore = s.max_fscore;
-      delete gold;
-      if (s.gold != NULL)
-		gold = s.gold->copy_tree();
-      else
-		gold = NULL;
-      delete gold0;
-      if (s.gold0 != NULL)
-		gold0 = s.gold0->copy_tree();
-      else
-		gold0 = NULL;
-      foreach (sp_parses_type, it, parses) {
-		delete it->parse;
-		delete it->parse0;
-      }
-      parses = s.parses;
-      foreach (sp_parses_type, it, parses) {
-		it->parse = it->parse->copy_tree();
-		it->parse0 = it->parse0->copy_tree();
-      }
-    }
+    sp_sentence_type copy(s);
+    swap(copy);
     return *this;
   }  // sp_sentence_type::operator=
 
-  //! copy constructor
-  //
-sp_sentence_type(const sp_sentence_type& s) 
-: gold_nedges(s.gold_nedges), max_fscore(s.max_fscore), parses(s.parses)
-  {
-    if (s.gold == NULL)
-      gold = NULL;
-    else
-      gold = s.gold->copy_tree();
-    foreach (sp_parses_type, it, parses) {
-      it->parse = it->parse->copy_tree(); 
-      it->parse0 = it->parse0->copy_tree();
-    }
+#if __cplusplus >= 201103L
+  sp_sentence_type(sp_sentence_type&& s) noexcept 
+  : gold(NULL), gold0(NULL), gold_nedges(0), max_fscore(0), nduplicates(0), logsumprob(0),
+    keep_raw_trees(true) {
+    swap(s);
   }  // sp_sentence_type::sp_sentence_type()
 
+  sp_sentence_type& operator= (sp_sentence_type&& s) noexcept {
+    swap(s);
+    return *this;
+  }  // sp_sentence_type::operator=
+#endif
+
+  //! swap() exchanges the contents of two sentences without copying
+  //! any trees
+  //
+  void swap(sp_sentence_type& s) {
+    std::swap(gold, s.gold);
+    std::swap(gold0, s.gold0);
+    std::swap(gold_nedges, s.gold_nedges);
+    std::swap(max_fscore, s.max_fscore);
+    parses.swap(s.parses);
+    std::swap(nduplicates, s.nduplicates);
+    std::swap(logsumprob, s.logsumprob);
+    label.swap(s.label);
+    std::swap(keep_raw_trees, s.keep_raw_trees);
+  }  // sp_sentence_type::swap()
+
+  //! clear() frees the sentence's trees, keeping the parse vector's
+  //! storage for the next sentence read into it
+  //
+  void clear() {
+    delete gold;
+    gold = NULL;
+    delete gold0;
+    gold0 = NULL;
+    parses.clear();
+    gold_nedges = 0;
+    max_fscore = 0;
+    nduplicates = 0;
+    logsumprob = 0;
+    label.clear();
+  }  // sp_sentence_type::clear()
+
 
   //! set_logcondprob() sets the log cond prob 
   //
@@ -247,18 +356,50 @@ sp_sentence_type(const sp_sentence_type& s)
   }  // sp_sentence_type::set_logcondprob()
 
 
-  //! read() returns true if read was successful.
+  //! find_duplicate() sets parses[i].duplicate_of to the index of the
+  //! first parse whose tree is identical to parse i's (or to i if there
+  //! is none), and returns true if parse i is a duplicate.  Feature
+  //! classes that only look at the tree need only count each distinct
+  //! tree once.
+  //
+  bool find_duplicate(size_t i) {
+    sp_parse_type& p = parses[i];
+    p.tree_hash = EXT_NAMESPACE::hash<sptree*>()(p.parse);
+    p.duplicate_of = i;
+    for (size_t j = 0; j < i; ++j)
+      if (parses[j].duplicate_of == j && parses[j].tree_hash == p.tree_hash
+	  && *parses[j].parse == *p.parse) {
+	p.duplicate_of = j;
+	++nduplicates;
+	return true;
+      }
+    return false;
+  }  // sp_sentence_type::find_duplicate()
+
+  //! original() returns the index of the first parse with the same
+  //! tree as parse i, or i if parse i hasn't been marked.
+  //
+  size_t original(size_t i) const {
+    size_t j = parses[i].duplicate_of;
+    return j == sp_parse_type::unmarked ? i : j;
+  }  // sp_sentence_type::original()
+
+  //! mark_duplicates() calls find_duplicate() on every parse, for
+  //! sentences whose parses were filled in by hand rather than read.
+  //
+  void mark_duplicates() {
+    nduplicates = 0;
+    for (size_t i = 0; i < parses.size(); ++i)
+      find_duplicate(i);
+  }  // sp_sentence_type::mark_duplicates()
+
+
+  //! read() returns true if read was successful.  If goldfp is NULL
+  //! only the n-best parses are read, and gold, gold_nedges and each
+  //! parse's nedges, ncorrect and f_score are left at 0.
   //
   bool read(FILE* parsefp, FILE* goldfp, bool downcase_flag=false) {
-    delete gold;
-    gold = NULL;
-    delete gold0;
-    gold0 = NULL;
-    foreach (sp_parses_type, it, parses) {
-      delete it->parse;
-      delete it->parse0;
-    }
-    parses.clear();
+    clear();
     unsigned int nparses;
     char parselabel[256];
     int nread = fscanf(parsefp, " %u %255s ", &nparses, parselabel);
@@ -269,6 +410,21 @@ sp_sentence_type(const sp_sentence_type& s)
       return false;
     }
 
+    label = parselabel;
+
+    if (goldfp == NULL) {     // no gold trees, so no evaluation
+      parses.resize(nparses);
+      for (size_t i = 0; i < nparses; ++i) {
+	if (!parses[i].read(parsefp, downcase_flag, keep_raw_trees)) {
+	  std::cerr << "## Reading parse tree " << i << " failed." << std::endl;
+	  return false;
+	}
+	find_duplicate(i);
+      }
+      set_logcondprob();
+      return true;
+    }
+
     char goldlabel[256];
     nread = fscanf(goldfp, " %255s ", goldlabel);
     if (nread != 1) {
@@ -284,8 +440,6 @@ sp_sentence_type(const sp_sentence_type& s)
       return false;
     }
 
-    label = parselabel;
-
     {
       char buffer[BUFSIZE];
       char* ret = fgets(buffer, BUFSIZE, goldfp);
@@ -299,17 +453,31 @@ sp_sentence_type(const sp_sentence_type& s)
 				  << "## buffer = " << buffer << std::endl;
 		return false;
       }
-      gold0 = readtree(buffer);
+      {
+	trace_span ts("readtree", "read");
+	gold0 = readtree(buffer);
+      }
       assert(gold0 != NULL);
       gold0->label.cat = tree::label_type::root();
       tree* gold1 = gold0->copy_without_empties();
       // gold1->delete_unary_same_label_chains();
-      gold = tree_sptree(gold1, downcase_flag);
+      {
+	trace_span ts("tree_sptree", "read");
+	gold = tree_sptree(gold1, downcase_flag);
+      }
       delete gold1;
+      if (!keep_raw_trees) {
+	delete gold0;
+	gold0 = NULL;
+      }
     }
 
     assert(gold != NULL);
-    precrec_type::edges gold_edges(gold);
+    precrec_type::edges gold_edges;
+    {
+      trace_span ts("gold_edges", "precrec");
+      precrec_type::tree_nontermedges(gold, gold_edges);
+    }
     gold_nedges = gold_edges.nedges();
 
     typedef std::vector<symbol> symbols;
@@ -318,7 +486,14 @@ sp_sentence_type(const sp_sentence_type& s)
     
     parses.resize(nparses);
     for (size_t i = 0; i < nparses; ++i) 
-      if (parses[i].read(parsefp, downcase_flag)) {
+      if (parses[i].read(parsefp, downcase_flag, keep_raw_trees)) {
+		if (find_duplicate(i)) {  // same tree, so same words and score
+		  const sp_parse_type& p = parses[parses[i].duplicate_of];
+		  parses[i].nedges = p.nedges;
+		  parses[i].ncorrect = p.ncorrect;
+		  parses[i].f_score = p.f_score;
+		  continue;
+		}
 		symbols parse_words;
 		parses[i].parse->terminals(parse_words);
 		if (gold_words != parse_words) {
@@ -328,6 +503,7 @@ sp_sentence_type(const sp_sentence_type& s)
 					<< std::endl;
 		  exit(EXIT_FAILURE);
 		}
+		trace_span ts("precrec", "precrec");
 		precrec_type pr(gold_edges, parses[i].parse);
 		parses[i].nedges = pr.ntest;
 		parses[i].ncorrect = pr.ncommon;
@@ -347,20 +523,38 @@ sp_sentence_type(const sp_sentence_type& s)
   }  // sp_sentence_type::read()
 
 
+  //! skip() reads past the next sentence in parsefp (and goldfp, if
+  //! it isn't NULL) without building any of its trees, returning true
+  //! if it succeeded.
+  //
+  static bool skip(FILE* parsefp, FILE* goldfp) {
+    unsigned int nparses;
+    char label[256];
+    if (fscanf(parsefp, " %u %255s ", &nparses, label) != 2)
+      return false;
+    for (size_t i = 0; i < nparses; ++i) {
+      Float logprob;
+      if (fscanf(parsefp, " " SCANF_FLOAT_FORMAT " ", &logprob) != 1 || !skip_line(parsefp))
+	return false;
+    }
+    return goldfp == NULL 
+      || (fscanf(goldfp, " %255s ", label) == 1 && skip_line(goldfp));
+  }  // sp_sentence_type::skip()
+
+  //! skip_line() reads up to and including the next newline in fp
+  //
+  static bool skip_line(FILE* fp) {
+    int c;
+    do c = getc(fp); while (c != EOF && c != '\n');
+    return c == '\n';
+  }  // sp_sentence_type::skip_line()
+
   //! read_ec_nbest() reads in a collection of n-best parses 
-  //! produced by Eugene Charniak's n-best parser.
+  //! produced by Eugene Charniak's n-best parser.  is fails if the
+  //! list is malformed or has no parses.
   //
   std::istream& read_ec_nbest(std::istream& is, bool downcase_flag=false) {
-    delete gold;
-    gold = NULL;
-    delete gold0;
-    gold0 = NULL;
-
-    foreach (sp_parses_type, it, parses) {
-      delete it->parse;
-      delete it->parse0;
-    }
-    parses.clear();
+    clear();
 
     size_t dummy;
     if (!(is >> dummy))
@@ -368,12 +562,15 @@ sp_sentence_type(const sp_sentence_type& s)
 
     size_t nparses;
     if (is >> nparses) {
-      assert(nparses > 0);
+      if (nparses == 0) {
+		is.setstate(std::ios::failbit);
+		return is;
+      }
       parses.resize(nparses);
       for (size_t i = 0; i < nparses; ++i) {
-		parses[i].read_ec_nbest(is, downcase_flag);
-		assert(is);
-		assert(parses[i].parse != NULL);
+		if (!parses[i].read_ec_nbest(is, downcase_flag, keep_raw_trees))
+		  return is;
+		find_duplicate(i);
       }
       set_logcondprob();
     }
@@ -382,31 +579,26 @@ sp_sentence_type(const sp_sentence_type& s)
 
   //! read_ec_nbest_15aug05() reads in a collection of n-best parses 
   //! produced by Eugene Charniak's n-best parser, in the format
-  //! he made up on the 15th August 2005.
+  //! he made up on the 15th August 2005.  is fails if the list is
+  //! malformed or has no parses.
   //
   std::istream& read_ec_nbest_15aug05(std::istream& is, bool downcase_flag=false) {
-    delete gold;
-    gold = NULL;
-    delete gold0;
-    gold0 = NULL;
-
-    foreach (sp_parses_type, it, parses) {
-      delete it->parse;
-      delete it->parse0;
-    }
-    parses.clear();
+    clear();
 
     size_t nparses;
     if (is >> nparses) {
-      assert(nparses > 0);
+      if (nparses == 0) {
+		is.setstate(std::ios::failbit);
+		return is;
+      }
 
       is >> label;  // read sentence identifier
 
       parses.resize(nparses);
       for (size_t i = 0; i < nparses; ++i) {
-		parses[i].read_ec_nbest(is, downcase_flag);
-		assert(is);
-		assert(parses[i].parse != NULL);
+		if (!parses[i].read_ec_nbest(is, downcase_flag, keep_raw_trees))
+		  return is;
+		find_duplicate(i);
       }
       set_logcondprob();
     }
@@ -415,6 +607,7 @@ sp_sentence_type(const sp_sentence_type& s)
 };  // sp_sentence_type{}
 
 
+inline
 std::ostream& operator<< (std::ostream& os, const sp_sentence_type& s) {
   return os << "(" << s.gold << " " << s.gold_nedges << " " << s.max_fscore
 			<< " " << s.parses << " " << s.logsumprob << ")";
@@ -429,16 +622,17 @@ typedef std::vector<sp_sentence_type> sp_sentences_type;
 //
 struct sp_corpus_type {
   sp_sentences_type sentences;
+  bool keep_raw_trees;   // read() sets each sentence's keep_raw_trees
   size_t nsentences() const { return sentences.size(); }
 
   // default constructor
   //
-sp_corpus_type() : sentences() { }
+sp_corpus_type() : sentences(), keep_raw_trees(true) { }
 
   // constructor from a file pointer
   //
 sp_corpus_type(FILE* parsefp, FILE* goldfp, bool downcase_flag=false) 
-: sentences() {
+: sentences(), keep_raw_trees(true) {
   bool status = read(parsefp, goldfp, downcase_flag);
   assert(status == true);
 }  // sp_corpus_type::sp_corpus_type()
@@ -446,7 +640,7 @@ sp_corpus_type(FILE* parsefp, FILE* goldfp, bool downcase_flag=false)
   // constructor from a bzip2'd filename
   //
 sp_corpus_type(const char parsefname[], const char goldfname[],
-			   bool downcase_flag = false) : sentences() {
+			   bool downcase_flag = false) : sentences(), keep_raw_trees(true) {
 				 FILE* parsefp = popen_decompress(parsefname);
 				 FILE* goldfp = popen_decompress(goldfname);
 				 bool successful_read = read(parsefp, goldfp, downcase_flag);
@@ -468,9 +662,41 @@ sp_corpus_type(const char parsefname[], const char goldfname[],
     return fp;
   }  // popen_file()
 
-  // read() returns true if the corpus was successfully read.
+  // nogold() is true if goldcmd means there are no gold trees,
+  // i.e., if it is NULL, empty or "-".
+  //
+  inline static bool nogold(const char goldcmd[]) {
+    return goldcmd == NULL || goldcmd[0] == '\0' || strcmp(goldcmd, "-") == 0;
+  }  // sp_corpus_type::nogold()
+
+  // more_sentences() skips whitespace in fp and returns true if
+  // there is anything left to read.
+  //
+  inline static bool more_sentences(FILE* fp) {
+    int c;
+    do c = getc(fp); while (c != EOF && isspace(c));
+    if (c == EOF)
+      return false;
+    ungetc(c, fp);
+    return true;
+  }  // sp_corpus_type::more_sentences()
+
+  // read() returns true if the corpus was successfully read.  If goldfp
+  // is NULL, the sentences are read from parsefp until end of file.
   //
   bool read(FILE* parsefp, FILE* goldfp, bool downcase_flag=false) {
+    if (goldfp == NULL) {
+      sentences.clear();
+      while (more_sentences(parsefp)) {
+	sentences.resize(sentences.size()+1);
+	sentences.back().keep_raw_trees = keep_raw_trees;
+	if (!sentences.back().read(parsefp, NULL, downcase_flag)) {
+	  std::cerr << "## Reading sentence tree " << sentences.size()-1 << " failed." << std::endl;	
+	  return false;
+	}
+      }
+      return true;
+    }
     unsigned int nsentences;
     int nread = fscanf(goldfp, " %u ", &nsentences);
     if (nread != 1) {
@@ -478,45 +704,64 @@ sp_corpus_type(const char parsefname[], const char goldfname[],
       return false;
     }
     sentences.resize(nsentences);
-    for (size_t i = 0; i < nsentences; ++i)
+    for (size_t i = 0; i < nsentences; ++i) {
+      sentences[i].keep_raw_trees = keep_raw_trees;
       if (!sentences[i].read(parsefp, goldfp, downcase_flag)) {
 		std::cerr << "## Reading sentence tree " << i << " failed." << std::endl;	
 		return false;
       }
+    }
     return true;
   }  // sp_corpus_type::read()
 
-  // map_sentences() calls fn on every sentence.
+  // map_sentences() calls fn on every sentence.  If goldfp is NULL,
+  // the sentences are read from parsefp until end of file.  The
+  // sentences keep their raw trees only if keep_raw_trees.
   //
   template <typename Proc>
   static size_t map_sentences(FILE* parsefp, FILE* goldfp,
-							  Proc& proc, bool downcase_flag=false) {
-    unsigned int nsentences;
-    int nread = fscanf(goldfp, " %u ", &nsentences);
-    if (nread != 1) {
-      std::cerr << "## Failed to read number of sentences at start of file." << std::endl;
-      return 0;
+							  Proc& proc, bool downcase_flag=false,
+							  bool keep_raw_trees=true) {
+    unsigned int nsentences = std::numeric_limits<unsigned int>::max();
+    if (goldfp != NULL) {
+      int nread = fscanf(goldfp, " %u ", &nsentences);
+      if (nread != 1) {
+	std::cerr << "## Failed to read number of sentences at start of file." << std::endl;
+	return 0;
+      }
     }
     sp_sentence_type sentence;
-    for (size_t i = 0; i < nsentences; ++i) {
-      if (!sentence.read(parsefp, goldfp, downcase_flag)) {
-		std::cerr << "## Reading sentence tree " << i << " failed." << std::endl;	
-		return 0;
+    sentence.keep_raw_trees = keep_raw_trees;
+    size_t i;
+    for (i = 0; i < nsentences && (goldfp != NULL || more_sentences(parsefp)); ++i) {
+      tracer::sentence(i);
+      trace_span ts("sentence", "sentence");
+      {
+	trace_span ts("read", "read");
+	if (!sentence.read(parsefp, goldfp, downcase_flag)) {
+	  std::cerr << "## Reading sentence tree " << i << " failed." << std::endl;	
+	  return 0;
+	}
       }
       proc(sentence);
     }
-    return nsentences;
+    tracer::end_sentence();
+    return i;
   }  // sp_corpus_type::map_sentences()
 
-  // map_sentences_cmd() calls fn on every sentence.
+  // map_sentences_cmd() calls fn on every sentence.  If nogold(goldcmd)
+  // then there are no gold trees.
   //
   template <typename Proc>
   static size_t map_sentences_cmd(const char parsecmd[], const char goldcmd[], Proc& proc, 
-								  bool downcase_flag = false) {
+								  bool downcase_flag = false,
+								  bool keep_raw_trees = true) {
     FILE* parsefp = popen(parsecmd, "r");
-    FILE* goldfp = popen(goldcmd, "r");
-    size_t nsentences = map_sentences(parsefp, goldfp, proc, downcase_flag);
-    pclose(goldfp);
+    FILE* goldfp = nogold(goldcmd) ? NULL : popen(goldcmd, "r");
+    size_t nsentences = map_sentences(parsefp, goldfp, proc, downcase_flag,
+				      keep_raw_trees);
+    if (goldfp != NULL)
+      pclose(goldfp);
     pclose(parsefp);
     return nsentences;
   }  // sp_corpus_type::map_sentences_cmd()
@@ -525,10 +770,12 @@ sp_corpus_type(const char parsefname[], const char goldfname[],
   //
   template <typename Proc>
   static size_t map_sentences(const char parsefname[], const char goldfname[], Proc& proc, 
-							  bool downcase_flag = false) {
+							  bool downcase_flag = false,
+							  bool keep_raw_trees = true) {
     FILE* parsefp = popen_decompress(parsefname);
     FILE* goldfp = popen_decompress(goldfname);
-    size_t nsentences = map_sentences(parsefp, goldfp, proc, downcase_flag);
+    size_t nsentences = map_sentences(parsefp, goldfp, proc, downcase_flag,
+				      keep_raw_trees);
     pclose(goldfp);
     pclose(parsefp);
     return nsentences;
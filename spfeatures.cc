@@ -0,0 +1,175 @@
+// spfeatures.cc
+//
+// This file is the compilation unit for libspfeatures.a.  It defines
+// the global flags declared in spfeatures.h and implements the
+// in-process extraction API declared in libspfeatures.h.
+
+#include "custom_allocator.h"       // must be first
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+
+#include "features.h"
+#include "libspfeatures.h"
+
+bool force_extract = false;
+int debug_level = 0;
+bool absolute_counts = false;
+bool collect_correct = false;
+bool collect_incorrect = false;
+bool lowercase_flag = false;
+bool profile_flag = false;
+size_t progress_interval = 0;
+size_t max_features = 0;
+
+struct spf_extractor {
+  std::string error;           //!< set by fcps' constructor if featureset is bad
+  FeatureClassPtrs fcps;
+  spf_id maxid;
+  bool lowercase;
+  sp_sentence_type sentence;   //!< reused by spf_extract()
+  Id_Floats p_i_v;
+
+  spf_extractor(const char* featureset, bool lowercase)
+    : fcps(featureset, error), maxid(0), lowercase(lowercase) { }
+};  // spf_extractor{}
+
+//! open_error describes why the calling thread's last spf_open() failed
+//! (a fixed buffer, so threads that exit don't leave anything behind)
+//
+static __thread char open_error[512];
+
+static spf_extractor* open_failed(const std::string& error) {
+  strncpy(open_error, error.c_str(), sizeof(open_error) - 1);
+  return NULL;
+}  // open_failed()
+
+//! nopen is the number of open extractors.  They all share the
+//! process-wide absolute_counts, which spf_open() sets when nopen is
+//! 0 and otherwise requires to match its flags; open_mutex guards both.
+//
+static pthread_mutex_t open_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t nopen = 0;
+
+spf_extractor* spf_open(const char* featureset, const char* featuremap, int flags) {
+  std::ifstream is(featuremap);
+  if (!is)
+    return open_failed(std::string("can't open feature map ") + featuremap);
+  bool absolute = flags & SPF_ABSOLUTE_COUNTS;
+  pthread_mutex_lock(&open_mutex);
+  bool conflict = nopen > 0 && absolute_counts != absolute;
+  if (!conflict) {
+    absolute_counts = absolute;
+    ++nopen;
+  }
+  pthread_mutex_unlock(&open_mutex);
+  if (conflict)
+    return open_failed(absolute ? "SPF_ABSOLUTE_COUNTS conflicts with the extractors already open"
+		       : "the extractors already open use SPF_ABSOLUTE_COUNTS");
+  spf_extractor* e = new spf_extractor(featureset, flags & SPF_LOWERCASE);
+  if (!e->error.empty()) {
+    std::string error = std::string("feature set ") + featureset + ": " + e->error;
+    spf_close(e);
+    return open_failed(error);
+  }
+  Id maxid;
+  if (!e->fcps.read_feature_ids(is, maxid, e->error)) {
+    std::string error = std::string(featuremap) + ": " + e->error;
+    spf_close(e);
+    return open_failed(error);
+  }
+  e->maxid = maxid + 1;
+  return e;
+}  // spf_open()
+
+void spf_close(spf_extractor* e) {
+  if (e != NULL) {
+    cforeach (FeatureClassPtrs, it, e->fcps)
+      delete *it;
+    delete e;
+    pthread_mutex_lock(&open_mutex);
+    --nopen;
+    pthread_mutex_unlock(&open_mutex);
+  }
+}  // spf_close()
+
+spf_id spf_maxid(const spf_extractor* e) {
+  return e->maxid;
+}  // spf_maxid()
+
+const char* spf_error(const spf_extractor* e) {
+  if (e == NULL)
+    return open_error;
+  return e->error.c_str();
+}  // spf_error()
+
+sptree* spf_read_sptree(const char* str, bool lowercase) {
+  tree* t = try_readtree(str);
+  if (t == NULL)
+    return NULL;
+  t->label.cat = tree::label_type::root();
+  sptree* sp = tree_sptree(t, lowercase);
+  delete t;
+  return sp;
+}  // spf_read_sptree()
+
+long spf_extract(spf_extractor* e, size_t nparses,
+		 const char* const* trees, const double* logprobs,
+		 spf_id* ids, double* values, size_t* offsets, size_t capacity) {
+  sp_sentence_type& sentence = e->sentence;
+  sentence.clear();
+  sentence.parses.resize(nparses);
+  for (size_t i = 0; i < nparses; ++i) {
+    sp_parse_type& p = sentence.parses[i];
+    p.logprob = logprobs[i];
+    p.parse = spf_read_sptree(trees[i], e->lowercase);
+    if (p.parse == NULL) {
+      e->error = "can't read parse tree ";
+      e->error += trees[i];
+      return -1;
+    }
+  }
+  return spf_extract_sentence(e, sentence, ids, values, offsets, capacity);
+}  // spf_extract()
+
+long spf_extract_sentence(spf_extractor* e, sp_sentence_type& sentence,
+			  spf_id* ids, double* values, size_t* offsets, size_t capacity) {
+  e->error.clear();
+  for (size_t j = 0; j < sentence.nparses(); ++j)
+    if (!finite(sentence.parses[j].logprob)) {
+      std::ostringstream os;
+      os << "parse " << j << " has logprob " << sentence.parses[j].logprob;
+      e->error = os.str();
+      return -1;
+    }
+  sentence.set_logcondprob();
+  sentence.mark_duplicates();
+  Id_Floats& p_i_v = e->p_i_v;
+  p_i_v.clear();
+  p_i_v.resize(sentence.nparses());
+  cforeach (FeatureClassPtrs, it, e->fcps)
+    (*it)->feature_values(sentence, p_i_v);
+
+  size_t n = 0;
+  for (size_t j = 0; j < p_i_v.size(); ++j) {
+    offsets[j] = n;
+    n += p_i_v[j].size();
+  }
+  offsets[p_i_v.size()] = n;
+  if (n > capacity)
+    return n;
+
+  n = 0;
+  cforeach (Id_Floats, it, p_i_v)
+    cforeach (Id_Float, it1, *it) {
+      ids[n] = it1->first;
+      values[n] = it1->second;
+      ++n;
+    }
+  return n;
+}  // spf_extract_sentence()
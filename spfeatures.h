@@ -36,11 +36,18 @@
 #include <cassert>
 #include <cstdio>
 #include <ext/hash_map>
+#include <fnmatch.h>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <map>
 #include <set>
+#include <sstream>
 #include <string>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <utility>
 #include <vector>
 #include <iostream>
@@ -48,10 +55,14 @@
 #include "lexical_cast.h"
 #include "sstring.h"
 #include "sp-data.h"
+#include "feature-dictionary.h"
 #include "heads.h"
 #include "popen.h"
+#include "profile.h"
 #include "sptree.h"
 #include "sym.h"
+#include "thread-pool.h"
+#include "trace.h"
 #include "tree.h"
 #include "utility.h"
 
@@ -62,7 +73,7 @@
 //
 #define SPFEATURES_COMMON_DEFINITIONS					\
 									\
-  typedef ext::hash_map<Feature,Id> Feature_Id;				\
+  typedef feature_dictionary<Feature> Feature_Id;			\
   Feature_Id feature_id;						\
 									\
   virtual void extract_features(const sp_sentence_type& s) {		\
@@ -74,18 +85,57 @@
     return prune_and_renumber_helper(*this, mincount, nextid, os);	\
   }									\
 									\
+  virtual size_type prune(const size_type mincount) {			\
+    return prune_helper(*this, mincount);				\
+  }									\
+									\
+  virtual void renumber(Id nextid) {					\
+    renumber_helper(*this, nextid);					\
+  }									\
+									\
+  virtual size_type prune_zero_weights(const Floats& ws) {		\
+    return prune_zero_weights_helper(*this, ws);			\
+  }									\
+									\
+  virtual void recount_candidates() {					\
+    recount_candidates_helper(*this);					\
+  }									\
+									\
+  virtual bool max_features_certain(const size_type mincount) const {	\
+    return max_features_certain_helper(*this, mincount);		\
+  }									\
+									\
   virtual void feature_values(const sp_sentence_type& s,		\
 			      Id_Floats& p_i_v)				\
   {									\
     feature_values_helper(*this, s, p_i_v);				\
   }                                                                     \
 									\
+  virtual void feature_scores(const sp_sentence_type& s,		\
+			      const Floats& ws, Floats& scores)		\
+  {									\
+    feature_scores_helper(*this, s, ws, scores);			\
+  }                                                                     \
+									\
   virtual std::ostream& print_feature_ids(std::ostream& os) const {	\
     return print_feature_ids_helper(*this, os);				\
   }									\
 									\
+  virtual std::ostream& print_feature_ids(std::ostream& os,		\
+					  const Ids& ids) const {	\
+    return print_feature_ids_helper(*this, os, &ids);			\
+  }									\
+									\
   virtual std::istream& read_feature(std::istream& is, Id id) {		\
     return read_feature_helper(*this, is, id);				\
+  }									\
+									\
+  virtual size_type nfeatures() const {					\
+    return feature_id.size();						\
+  }									\
+									\
+  virtual size_t dictionary_bytes() const {				\
+    return dictionary_bytes_helper(*this);				\
   }
 
 
@@ -95,6 +145,9 @@ extern bool absolute_counts;    //!< produce absolute rather than relative count
 extern bool collect_correct;    //!< collect features from correct parse
 extern bool collect_incorrect;  //!< collect features from incorrect parse
 extern bool lowercase_flag;     //!< lowercase all terminals when reading tree
+extern bool profile_flag;       //!< collect per-FeatureClass profiling data
+extern size_t progress_interval; //!< report progress every so many sentences (0 = never)
+extern size_t max_features;     //!< keep each class' max_features most frequent features (0 = all)
 
 typedef unsigned int size_type;
 typedef size_type Id;           //!< type of feature Ids
@@ -102,6 +155,52 @@ typedef size_type Id;           //!< type of feature Ids
 
 typedef std::map<Id,Float> Id_Float;
 typedef std::vector<Id_Float> Id_Floats;
+typedef std::vector<Float> Floats;  //!< feature weights, indexed by Id
+typedef std::vector<Id> Ids;        //!< an Id translation table, indexed by Id
+
+//! no_id marks the Ids that an Id translation table drops
+//
+const Id no_id = Id(-1);
+
+//! write_message() writes msg to std::cerr in one piece.  std::cerr
+//! isn't thread-safe once sync_with_stdio(false) has been called, so
+//! code that may run on several threads at once writes through this.
+//
+inline void write_message(const std::string& msg) {
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_mutex_lock(&mutex);
+  std::cerr << msg << std::flush;
+  pthread_mutex_unlock(&mutex);
+}  // write_message()
+
+//! heap_bytes() approximates the heap memory owned by a feature,
+//!  not counting the feature object itself.  It is only used to
+//!  estimate dictionary sizes when profiling.
+//
+template <typename T> inline size_t heap_bytes(const T& x);
+inline size_t heap_bytes(const sstring& s);
+template <typename T> inline size_t heap_bytes(const std::vector<T>& xs);
+template <typename T1, typename T2> inline size_t heap_bytes(const std::pair<T1,T2>& p);
+
+template <typename T>
+inline size_t heap_bytes(const T& x) { return 0; }
+
+inline size_t heap_bytes(const sstring& s) {
+  return s.capacity() > 15 ? s.capacity()+1 : 0;  // short strings are stored inline
+}
+
+template <typename T>
+inline size_t heap_bytes(const std::vector<T>& xs) {
+  size_t n = xs.capacity()*sizeof(T);
+  cforeach (typename std::vector<T>, it, xs)
+    n += heap_bytes(*it);
+  return n;
+}
+
+template <typename T1, typename T2>
+inline size_t heap_bytes(const std::pair<T1,T2>& p) {
+  return heap_bytes(p.first) + heap_bytes(p.second);
+}
 
 ////////////////////////////////////////////////////////////////////////
 //                                                                    //
@@ -118,7 +217,7 @@ typedef std::vector<Id_Float> Id_Floats;
 //!   Feature    -- the type of features belonging to FeatureClass
 //!                   (operator << should be defined on Feature)
 //!
-//!   Feature_Id -- an efficient map type from features to Id
+//!   Feature_Id -- the feature_dictionary<Feature> mapping features to Ids
 //!
 //! Each FeatureClass object must also have members:
 //!
@@ -131,6 +230,10 @@ public:
   //
   virtual ~FeatureClass() { };
 
+  FeatureClass() 
+    : count_candidates_only(false), ndecrements(0), count_offset(0), 
+      min_candidate_count(Id(-1)) { }
+
   // These next virtual functions must be implemented by any FeatureClass
   
   //! identifier() returns a unique identifying string for this
@@ -154,15 +257,56 @@ public:
   virtual Id prune_and_renumber(const size_type mincount, Id nextid, 
 				std::ostream& os) = 0;
 
+  //! prune() and renumber() split prune_and_renumber() in two, so
+  //!  that the classes can be pruned concurrently before their Id
+  //!  ranges are known.  prune() prunes the features as
+  //!  prune_and_renumber() does, numbering the remaining features from
+  //!  0, and returns their number.  renumber() then adds nextid to
+  //!  every feature's id.
+  //
+  virtual size_type prune(const size_type mincount) = 0;
+  virtual void renumber(Id nextid) = 0;
+
+  //! prune_zero_weights() removes all features whose weight in ws
+  //!  is zero (or which have no weight at all), so feature_values()
+  //!  no longer looks them up.  It returns the number of features kept.
+  //
+  virtual size_type prune_zero_weights(const Floats& ws) = 0;
+
+  //! recount_candidates() zeroes the counts of the features in the
+  //!  dictionary and makes extract_features() count only those
+  //!  features, so that a second pass over the data counts them exactly.
+  //
+  virtual void recount_candidates() = 0;
+
+  //! max_features_certain() returns true unless, with max_features
+  //!  set, a feature dropped while counting might have been among the
+  //!  max_features most frequent of those occurring in at least
+  //!  mincount sentences, and so should have been kept by prune().
+  //
+  virtual bool max_features_certain(const size_type mincount) const = 0;
+
   //! feature_values() collects the feature values for the sentence s
   //
   virtual void feature_values(const sp_sentence_type& s, Id_Floats& piv) = 0;
 
+  //! feature_scores() adds to scores[i] the weighted sum, using
+  //!  weights ws, of this class' feature values on parse i of s
+  //
+  virtual void feature_scores(const sp_sentence_type& s, const Floats& ws,
+			      Floats& scores) = 0;
+
 
   //! print_feature_ids() prints out the features and their ids.
   //
   virtual std::ostream& print_feature_ids(std::ostream& os) const = 0;
 
+  //! print_feature_ids(os, ids) prints out the features that ids
+  //!  doesn't map to no_id, with their translated ids.
+  //
+  virtual std::ostream& print_feature_ids(std::ostream& os, 
+					  const Ids& ids) const = 0;
+
 
   //! read_feature() reads the feature definition from in, and
   //!  sets its id to id.
@@ -170,6 +314,57 @@ public:
   virtual std::istream& read_feature(std::istream& is, Id id) = 0;
 
 
+  //! nfeatures() returns the number of features in the dictionary.
+  //
+  virtual size_type nfeatures() const = 0;
+
+
+  //! dictionary_bytes() returns the approximate number of bytes
+  //!  used by the feature dictionary.
+  //
+  virtual size_t dictionary_bytes() const = 0;
+
+
+  //! profile holds the profiling counters for this FeatureClass;
+  //!  it is only updated when profile_flag is set.
+  //
+  featureclass_profile profile;
+
+
+  //! count_candidates_only is set by recount_candidates()
+  //
+  bool count_candidates_only;
+
+  //! ndecrements is the number of times count_feature() decremented
+  //!  every candidate's count; no feature it dropped occurred in more
+  //!  than ndecrements sentences.
+  //
+  size_t ndecrements;
+
+  //! count_offset is the amount count_feature() has (lazily) taken
+  //!  from every candidate's count: a candidate's count is its Id less
+  //!  count_offset.  min_candidate_count is at most the smallest
+  //!  candidate's Id, so that no candidate can reach a count of zero
+  //!  until count_offset reaches it.
+  //
+  Id count_offset;
+  Id min_candidate_count;
+
+  //! kept_counts holds the counts of the features that prune() kept
+  //!  (counts are held in Ids while counting), indexed by the id
+  //!  prune() gave them, so that higher thresholds can be applied
+  //!  later without recounting.
+  //
+  Ids kept_counts;
+
+
+  //! tree_only is true of classes whose feature counts depend only
+  //!  on the parse tree, so parses with identical trees have identical
+  //!  counts.  TreeFeatureClass redefines it.
+  //
+  static const bool tree_only = false;
+
+
   //! define commonly used symbols
   //
   inline static symbol endmarker() { static symbol e("_"); return e; }
@@ -273,16 +468,101 @@ public:
     IdParseVal(FeatClass& fc) : fc(fc), ignored(0) { }
 
     V& operator[](const Feature& f) {
-      typedef typename FeatClass::Feature_Id::const_iterator It;
-      It it = fc.feature_id.find(f);
-      if (it != fc.feature_id.end())
-	return f_p_v[it->second][parse];
+      const Id* id = fc.feature_id.find(f);
+      if (id != NULL)
+	return f_p_v[*id][parse];
       else 
 	return ignored;
     }  // IdParseVal::operator[]
 
   };  // FeatureClass::IdParseVal{}
+
+  //! An IdScoreVal object is used like an IdParseVal object, but it
+  //! only collects the counts of features with a non-zero weight, so
+  //! feature_scores_helper() can add each one's weighted value into
+  //! the parse scores without building a parse_id_count vector.
+  //
+  template <typename FeatClass>
+  struct IdScoreVal {
+    typedef Id F;
+    typedef Float V;
+    typedef std::map<size_type,V> C_V;
+    typedef std::map<F,C_V> F_C_V;
+
+    FeatClass& fc;
+    const Floats& ws;
+    size_type  parse;
+    F_C_V      f_p_v;
+    V	       ignored;
+
+    IdScoreVal(FeatClass& fc, const Floats& ws) : fc(fc), ws(ws), ignored(0) { }
+
+    V& operator[](const typename FeatClass::Feature& f) {
+      const Id* id = fc.feature_id.find(f);
+      if (id == NULL || *id >= ws.size() || ws[*id] == 0)
+	return ignored;
+      else
+	return f_p_v[*id][parse];
+    }  // IdScoreVal::operator[]
+
+  };  // FeatureClass::IdScoreVal{}
+
+  //! highest_gain_value() returns the value that relative counts are
+  //!  measured from: the value v of parse_val (a map from parses to
+  //!  values) that maximizes 2 * count(v) + count(v+1).
+  //
+  template <typename C_V>
+  static typename C_V::mapped_type highest_gain_value(const C_V& parse_val,
+						      size_type nparses) {
+    typedef typename C_V::mapped_type V;
+    typedef std::map<V, size_type> V_C;
+    V_C val_gain;  // number of times each feature value occured
+    for (size_type i = 0; i < nparses; ++i) {
+      const V val = dfind(parse_val, i);
+      val_gain[val] += 2;
+      val_gain[val-1] += 1;
+    }
+    return max_element(val_gain, second_lessthan())->first;
+  }  // FeatureClass::highest_gain_value()
       
+  //! counted_parse() returns the parse of s whose feature counts are
+  //!  used for parse i: parse i itself, unless fc only looks at trees
+  //!  and parse i's tree duplicates an earlier one.
+  //
+  template <typename FeatClass>
+  static size_type counted_parse(const FeatClass& fc, const sp_sentence_type& s,
+				 size_type i) {
+    return FeatClass::tree_only ? s.original(i) : i;
+  }  // FeatureClass::counted_parse()
+
+  //! sentence_featurecounts() calls parse_featurecount() on each
+  //!  parse of s, counting each distinct tree only once if it can,
+  //!  and then copies the counts collected in f_p_v to the duplicates.
+  //
+  template <typename FeatClass, typename Feat_Count>
+  static void sentence_featurecounts(FeatClass& fc, const sp_sentence_type& s,
+				     Feat_Count& feat_count) {
+    for (size_type i = 0; i < s.nparses(); ++i) 
+      if (counted_parse(fc, s, i) == i) {
+	feat_count.parse = i;
+	fc.parse_featurecount(fc, s.parses[i], feat_count);
+      }
+    if (!FeatClass::tree_only || s.nduplicates == 0)
+      return;
+    typedef typename Feat_Count::C_V C_V;
+    foreach (typename Feat_Count::F_C_V, fit, feat_count.f_p_v) {
+      C_V& p_v = fit->second;
+      for (size_type i = 0; i < s.nparses(); ++i) {
+	size_type j = s.original(i);
+	if (j != i) {
+	  typename C_V::const_iterator it = p_v.find(j);
+	  if (it != p_v.end())
+	    p_v[i] = it->second;
+	}
+      }
+    }
+  }  // FeatureClass::sentence_featurecounts()
+
   //! sentence_parsefidvals() calls parse_featurecount() to get the
   //!  feature count for each parse, then subtracts the most common
   //!  count for each feature from each count.  This means that feature
@@ -297,10 +577,7 @@ public:
 
     fid_parse_val.f_p_v.clear();
 
-    for (size_type i = 0; i < s.nparses(); ++i) {
-      fid_parse_val.parse = i;
-      fc.parse_featurecount(fc, s.parses[i], fid_parse_val);
-    }
+    sentence_featurecounts(fc, s, fid_parse_val);
 
     // copy into parse_fid_val, removing pseudo-constant features
 
@@ -308,7 +585,6 @@ public:
     typedef typename Fid_Parse_Val::V V;
     typedef typename Fid_Parse_Val::C_V C_V;
     typedef typename Fid_Parse_Val::F_C_V F_C_V;
-    typedef std::map<V, size_type> V_C;
 
     cforeach (typename F_C_V, fit, fid_parse_val.f_p_v) {
       const F& feat = fit->first;
@@ -321,13 +597,7 @@ public:
 		}
       }
       else {  // relative counts
-		V_C val_gain;  // number of times each feature value occured
-		for (size_type i = 0; i < s.nparses(); ++i) {
-		  const V val = dfind(parse_val, i);
-		  val_gain[val] += 2;
-		  val_gain[val-1] += 1;
-		}
-		const V& highest_gain_val = max_element(val_gain, second_lessthan())->first;
+		const V highest_gain_val = highest_gain_value(parse_val, s.nparses());
 		for (size_type i = 0; i < s.nparses(); ++i) {
 		  const V val = dfind(parse_val, i) - highest_gain_val;
 		  if (val != 0)
@@ -354,10 +624,7 @@ public:
 
     FPV fpv;
 
-    for (size_type i = 0; i < s.nparses(); ++i) {
-      fpv.parse = i;
-      fc.parse_featurecount(fc, s.parses[i], fpv);
-    }
+    sentence_featurecounts(fc, s, fpv);
 
     // trace if required
     
@@ -376,6 +643,8 @@ public:
 
     cforeach (typename F_C_V, it, fpv.f_p_v) {
       const C_V& p_v = it->second;
+      if (profile_flag)
+	fc.profile.ngenerated += p_v.size();
       bool pseudoconstant = !force_extract;
       if (p_v.size() != s.nparses()) // does feature occur on
 		pseudoconstant = false;      //  every parse?
@@ -392,28 +661,132 @@ public:
 		if ((collect_correct && p_v.find(0) != p_v.end())
 			|| (collect_incorrect 
 				&& (p_v.find(0) == p_v.end() || p_v.size() > 1)))
-		  ++fc.feature_id[it->first];
+		  count_feature(fc, it->first);
     }
 
   }  // FeatureClass::extract_features_helper()
 
 
-  //! print_feature_ids_helper() prints the feature_ids
+  //! count_feature() increments the count of feat in fc.feature_id.
+  //!
+  //! With max_features set, feature_id is a Misra-Gries heavy-hitter
+  //! summary of at most 2*max_features candidates: a new feature that
+  //! arrives when it is full is dropped and every candidate's count is
+  //! decremented instead, removing those that reach zero.  Every feature
+  //! occurring in more than a 1/(2*max_features+1) fraction of the
+  //! counted sentences survives, with its count underestimated by at
+  //! most the number of decrements.
+  //!
+  //! The decrements are done lazily, by incrementing fc.count_offset;
+  //! the candidates are only scanned, by evict_candidates(), once
+  //! count_offset reaches min_candidate_count, i.e., when some
+  //! candidate may have reached zero.
   //
   template <typename FeatClass>
-  static std::ostream& print_feature_ids_helper(const FeatClass& fc, std::ostream& os) {
-    typedef const typename FeatClass::Feature* FeaturePtr;
-    typedef std::pair<Id,FeaturePtr> IdFeaturePtr;
-    typedef std::vector<IdFeaturePtr> IdFeaturePtrs;
-    IdFeaturePtrs idfps;;
-    idfps.reserve(fc.feature_id.size());
-    cforeach (typename FeatClass::Feature_Id, it, fc.feature_id)
-      idfps.push_back(IdFeaturePtr(it->second, &it->first));
-    std::sort(idfps.begin(), idfps.end());
-    cforeach (typename IdFeaturePtrs, it, idfps)
+  static void count_feature(FeatClass& fc, const typename FeatClass::Feature& feat) {
+    Id* count = fc.feature_id.find(feat);
+    if (count != NULL)
+      ++*count;
+    else if (fc.count_candidates_only)
+      return;
+    else if (max_features == 0 || fc.feature_id.size() < 2*max_features) {
+      fc.feature_id.insert(feat, fc.count_offset+1);
+      fc.min_candidate_count = std::min(fc.min_candidate_count, fc.count_offset+1);
+    }
+    else {
+      ++fc.ndecrements;
+      if (++fc.count_offset >= fc.min_candidate_count)
+	evict_candidates(fc);
+    }
+  }  // FeatureClass::count_feature()
+
+
+  //! evict_candidates() removes the candidates whose count has reached
+  //! zero, and recomputes min_candidate_count
+  //
+  template <typename FeatClass>
+  static void evict_candidates(FeatClass& fc) {
+    typedef typename FeatClass::Feature_Id Feature_Id;
+    Id min_count = Id(-1);
+    for (typename Feature_Id::iterator it = fc.feature_id.begin(); it != fc.feature_id.end(); ) 
+      if (it.id() <= fc.count_offset)
+	fc.feature_id.erase(it++);
+      else {
+	min_count = std::min(min_count, it.id());
+	++it;
+      }
+    fc.min_candidate_count = min_count;
+    fc.feature_id.purge();
+  }  // FeatureClass::evict_candidates()
+
+
+  //! recount_candidates_helper() zeroes the candidates' counts for an
+  //! exact recount
+  //
+  template <typename FeatClass>
+  static void recount_candidates_helper(FeatClass& fc) {
+    foreach (typename FeatClass::Feature_Id, it, fc.feature_id)
+      it.id() = 0;
+    fc.count_offset = 0;
+    fc.count_candidates_only = true;
+  }  // FeatureClass::recount_candidates_helper()
+
+
+  //! may_miss_features() is true if a feature occurring in ndecrements
+  //! sentences might belong among the max_features features kept at
+  //! threshold mincount, when nqualifying candidates reach mincount
+  //! and the max_features'th most frequent of them has count kth
+  //
+  static bool may_miss_features(size_t ndecrements, size_type mincount, 
+				size_type nqualifying, Id kth) {
+    return ndecrements > 0 && (nqualifying < max_features 
+			       ? ndecrements >= mincount 
+			       : ndecrements > kth);
+  }  // FeatureClass::may_miss_features()
+
+
+  //! max_features_certain_helper() implements max_features_certain()
+  //
+  template <typename FeatClass>
+  static bool max_features_certain_helper(const FeatClass& fc, const size_type mincount) {
+    if (max_features == 0)
+      return true;
+    Ids counts;
+    cforeach (typename FeatClass::Feature_Id, it, fc.feature_id) 
+      if (it.id() - fc.count_offset >= mincount)
+	counts.push_back(it.id() - fc.count_offset);
+    Id kth = 0;
+    if (counts.size() >= max_features) {
+      std::nth_element(counts.begin(), counts.begin() + (max_features-1), counts.end(), 
+		       std::greater<Id>());
+      kth = counts[max_features-1];
+    }
+    return !may_miss_features(fc.ndecrements, mincount, counts.size(), kth);
+  }  // FeatureClass::max_features_certain_helper()
+
+
+  //! print_feature_ids_helper() prints the feature_ids; with ids,
+  //! each feature's id is translated through ids, and the features
+  //! that ids maps to no_id are skipped
+  //
+  template <typename FeatClass>
+  static std::ostream& print_feature_ids_helper(const FeatClass& fc, std::ostream& os,
+						const Ids* ids = NULL) {
+    typedef typename FeatClass::Feature_Id::const_iterator It;
+    typedef std::pair<Id,It> IdIt;
+    typedef std::vector<IdIt> IdIts;
+    IdIts idits;
+    idits.reserve(fc.feature_id.size());
+    cforeach (typename FeatClass::Feature_Id, it, fc.feature_id) {
+      Id id = ids ? (*ids)[it.id()] : it.id();
+      if (id != no_id)
+	idits.push_back(IdIt(id, it));
+    }
+    std::sort(idits.begin(), idits.end(), first_lessthan());
+    cforeach (typename IdIts, it, idits)
       os << it->first
 	 << '\t' << fc.identifier() 
-	 << ' ' << *it->second
+	 << ' ' << it->second.key()
 	 << '\n';
     os << std::flush;    
     return os;
@@ -421,31 +794,124 @@ public:
 
 
   //! prune_and_renumber_helper() extracts all features with at
-  //! least mincount count, and numbers the remaining features
-  //! incrementally from nextid. 
+  //! least mincount count (and, with max_features set, only the
+  //! max_features most frequent of them), and numbers the remaining
+  //! features incrementally from nextid. 
   //
   template <typename FeatClass>
   static Id prune_and_renumber_helper(FeatClass& fc, const size_type mincount,
 				      Id nextid, std::ostream& os)
+  {
+    size_type nkept = prune_helper(fc, mincount);
+    renumber_helper(fc, nextid);
+    print_feature_ids_helper(fc, os);
+    return nextid + nkept;
+  }  // FeatureClass::prune_and_renumber_helper()
+
+
+  //! prune_helper() does the work of prune_and_renumber_helper(),
+  //! numbering the kept features from 0
+  //
+  template <typename FeatClass>
+  static size_type prune_helper(FeatClass& fc, const size_type mincount)
   {
     typedef typename FeatClass::Feature F;
     typedef std::vector<F> Fs;
     Fs fs;
 
-    cforeach (typename FeatClass::Feature_Id, it, fc.feature_id) 
-      if (it->second >= mincount) 
-	fs.push_back(it->first);
+    fc.kept_counts.clear();
+    if (max_features == 0) {
+      assert(fc.count_offset == 0);
+      cforeach (typename FeatClass::Feature_Id, it, fc.feature_id) 
+	if (it.id() >= mincount) {
+	  fs.push_back(it.key());
+	  fc.kept_counts.push_back(it.id());
+	}
+    }
+    else {
+      typedef typename FeatClass::Feature_Id::const_iterator It;
+      typedef std::pair<Id,It> CountFeature;
+      typedef std::vector<CountFeature> CountFeatures;
+      CountFeatures cfs;
+      cforeach (typename FeatClass::Feature_Id, it, fc.feature_id) 
+	if (it.id() - fc.count_offset >= mincount) 
+	  cfs.push_back(CountFeature(it.id() - fc.count_offset, it));
+      std::stable_sort(cfs.begin(), cfs.end(), first_greaterthan());
+      if (cfs.size() > max_features)
+	cfs.resize(max_features);
+      // a dropped feature occurred in at most ndecrements sentences, so
+      // it may belong in the dictionary if that many would qualify
+      if (may_miss_features(fc.ndecrements, mincount, cfs.size(),
+			    cfs.empty() ? 0 : cfs.back().first)) {
+	std::ostringstream msg;
+	msg << "## Warning: " << fc.identifier() << " may be missing features that occur in up to "
+	    << fc.ndecrements << " sentences; increase --max-features\n";
+	write_message(msg.str());
+      }
+      cforeach (typename CountFeatures, it, cfs) {
+	fs.push_back(it->second.key());
+	fc.kept_counts.push_back(it->first);
+      }
+    }
+
+    if (profile_flag) {
+      fc.profile.ndistinct = fc.feature_id.size();
+      fc.profile.nkept = fs.size();
+      fc.profile.nbytes_counted = dictionary_bytes_helper(fc);
+    }
 
     fc.feature_id.clear();
 
+    Id id = 0;
     cforeach (typename Fs, it, fs) 
-      fc.feature_id[*it] = nextid++;
+      fc.feature_id.insert(*it, id++);
+    return id;
+  }  // FeatureClass::prune_helper()
 
-    print_feature_ids_helper(fc, os);
-    return nextid;
-  }  // FeatureClass::prune_and_renumber_helper()
+
+  //! renumber_helper() adds nextid to the id of every feature
+  //
+  template <typename FeatClass>
+  static void renumber_helper(FeatClass& fc, Id nextid)
+  {
+    foreach (typename FeatClass::Feature_Id, it, fc.feature_id)
+      it.id() += nextid;
+  }  // FeatureClass::renumber_helper()
+
+
+  //! prune_zero_weights_helper() keeps only the features with a
+  //! nonzero weight in ws.  Ids are left unchanged.
+  //
+  template <typename FeatClass>
+  static size_type prune_zero_weights_helper(FeatClass& fc, const Floats& ws)
+  {
+    for (typename FeatClass::Feature_Id::iterator it = fc.feature_id.begin(); 
+	 it != fc.feature_id.end(); )
+      if (it.id() < ws.size() && ws[it.id()] != 0)
+	++it;
+      else
+	fc.feature_id.erase(it++);
+    return fc.feature_id.size();
+  }  // FeatureClass::prune_zero_weights_helper()
 
   
+  //! dictionary_bytes_helper() approximates the memory used by feature_id:
+  //!  the bucket array, plus a node and any heap storage for each entry,
+  //!  or the class's share of the shared dictionary.
+  //
+  template <typename FeatClass>
+  static size_t dictionary_bytes_helper(const FeatClass& fc) {
+    if (fc.feature_id.shared())
+      return fc.feature_id.shared_bytes();
+    typedef typename FeatClass::Feature_Id::Map::value_type FI;
+    size_t n = fc.feature_id.bucket_count()*sizeof(void*)
+      + fc.feature_id.size()*(sizeof(FI)+sizeof(void*));
+    cforeach (typename FeatClass::Feature_Id, it, fc.feature_id)
+      n += heap_bytes(it.key());
+    return n;
+  }  // FeatureClass::dictionary_bytes_helper()
+
+
   //! feature_values_helper() maps a sentence to its parse_id_count vector
   //
   template <typename FeatClass>
@@ -459,26 +925,51 @@ public:
   } // FeatureClass::feature_values_helper()
 
 
+  //! feature_scores_helper() adds the weighted feature values of each
+  //! parse of s to scores, without building a parse_id_count vector
+  //
+  template <typename FeatClass>
+  static void feature_scores_helper(FeatClass& fc, const sp_sentence_type& s, 
+				    const Floats& ws, Floats& scores) 
+  {
+    assert(scores.size() == s.nparses());
+
+    typedef IdScoreVal<FeatClass> ISV;
+    ISV i_s_v(fc, ws);
+
+    sentence_featurecounts(fc, s, i_s_v);
+
+    // each feature adds weight times its (possibly relative) value,
+    // in increasing id order, just as summing the parse_id_count
+    // vector written by feature_values() does
+    //
+    cforeach (typename ISV::F_C_V, fit, i_s_v.f_p_v) {
+      const Float w = ws[fit->first];
+      const typename ISV::C_V& parse_val = fit->second;
+      const Float highest_gain_val = 
+	absolute_counts ? 0 : highest_gain_value(parse_val, s.nparses());
+      for (size_type i = 0; i < s.nparses(); ++i) {
+	Float val = dfind(parse_val, i) - highest_gain_val;
+	if (val != 0)
+	  scores[i] += w * val;
+      }
+    }
+  } // FeatureClass::feature_scores_helper()
+
+
   //! read_feature_helper() reads the next feature from is, and
   //! sets its id to id.  This method reads the entire rest of the
-  //! line and defines the feature accordingly.
+  //! line and defines the feature accordingly.  It sets is's failbit
+  //! if the feature can't be read, or has already been read.
   //
   template <typename FeatClass>
   static std::istream&
   read_feature_helper(FeatClass& fc, std::istream& is, Id id)
   {
     typedef typename FeatClass::Feature F;
-    typedef typename FeatClass::Feature_Id::value_type FI;
     F f;
-    is >> f;
-    assert(is);
-    bool inserted = fc.feature_id.insert(FI(f, id)).second;
-    if (!inserted) {
-      std::cerr << "## Error in spfeatures:read_feature_helper(): "
-		<< "duplicate feature, id = " << id
-		<< ", f = `" << f << "'" << std::endl;
-      exit(EXIT_FAILURE);
-    }
+    if (is >> f && !fc.feature_id.insert(f, id))
+      is.setstate(std::ios::failbit);
     return is;
   }  // FeatureClass::read_feature_helper()
 
@@ -516,8 +1007,17 @@ private:
       if (debug_level > 1000)
 	std::cerr << '\n' << s.parses[0].parse << '\n' << std::endl;
 
-      foreach (FeatureClassPtrs, it, fcps)
-	(*it)->extract_features(s);
+      fcps.count_sentence(s);
+      if (profile_flag || tracer::active())
+	foreach (FeatureClassPtrs, it, fcps) {
+	  profile_scope ps((*it)->profile.extract);
+	  alloc_tracker::scope as(alloc_tracker::featureclass, (*it)->profile.extract_allocs);
+	  trace_span ts((*it)->identifier(), "extract");
+	  (*it)->extract_features(s);
+	}
+      else
+	foreach (FeatureClassPtrs, it, fcps)
+	  (*it)->extract_features(s);
     }  // FeatureClassPtrs::extract_features_visitor::operator()
 
   };  // FeatureClassPtrs::extract_features_visitor{}
@@ -528,36 +1028,425 @@ public:
   //! The following load FeatureClassPtrs with various sets of features
   //
   inline FeatureClassPtrs(const char* fcname=NULL);
+  inline FeatureClassPtrs(const char* fcname, std::string& error);
 
   inline void features_050902(bool nonlocal=true);
   inline void features_spnn(bool nngram=false);
+  inline void features_matching(const char* spec);
+  inline bool features_matching(const char* spec, std::string& error);
+
+private:
+  inline bool load_features(const char* fcname, std::string& error);
+
+public:
+
+  //! stats counts the sentences and parses processed by the most
+  //! recent extract_features(), prune_and_renumber() or write_features().
+  //
+  phase_stats stats;
+
+  //! count_sentence() adds s to st (by default stats), and writes a
+  //! progress line every progress_interval sentences.
+  //
+  void count_sentence(const sp_sentence_type& s) { count_sentence(s, stats); }
+
+  static void count_sentence(const sp_sentence_type& s, phase_stats& st) {
+    ++st.nsentences;
+    st.nparses += s.nparses();
+    st.nduplicates += s.nduplicates;
+    if (progress_interval > 0 && st.nsentences % progress_interval == 0) {
+      std::ostringstream os;
+      os << "# progress: " << st << ", usage " << resource_usage() << '\n';
+      write_message(os.str());
+    }
+  }  // FeatureClassPtrs::count_sentence()
 
   //! extract_features() extracts features from the tree file infile.
   //
   void extract_features(const char* parseincmd, const char* goldincmd) {
+    stats.start("count");
+    alloc_tracker::scope as(alloc_tracker::phase, stats.allocs);
+    trace_span ts("count", "phase", true);
     extract_features_visitor efv(*this);
-    sp_corpus_type::map_sentences_cmd(parseincmd, goldincmd, efv, lowercase_flag);
+    sp_corpus_type::map_sentences_cmd(parseincmd, goldincmd, efv, lowercase_flag, false);
   }  // FeatureClassPtrs::extract_features()
 
+  //! recount_features() rereads the tree files to count exactly the
+  //! features that survived extract_features(), whose counts are only
+  //! lower bounds when max_features is set.
+  //
+  void recount_features(const char* parseincmd, const char* goldincmd) {
+    stats.start("recount");
+    alloc_tracker::scope as(alloc_tracker::phase, stats.allocs);
+    trace_span ts("recount", "phase", true);
+    foreach (FeatureClassPtrs, it, *this)
+      (*it)->recount_candidates();
+    extract_features_visitor efv(*this);
+    sp_corpus_type::map_sentences_cmd(parseincmd, goldincmd, efv, lowercase_flag, false);
+  }  // FeatureClassPtrs::recount_features()
+
+  //! max_features_certain() returns true if every class' recounted
+  //! candidates certainly include its max_features most frequent
+  //! features at threshold mincount; otherwise it sets error to name
+  //! the classes where a dropped feature might belong.
+  //
+  bool max_features_certain(const size_type mincount, std::string& error) const {
+    std::string classes;
+    cforeach (FeatureClassPtrs, it, *this)
+      if (!(*it)->max_features_certain(mincount))
+	classes += std::string(classes.empty() ? "" : ", ") + (*it)->identifier();
+    if (classes.empty())
+      return true;
+    error = "features dropped while counting may belong among the " 
+      + lexical_cast<std::string>(max_features) + " most frequent of " + classes 
+      + "; increase --max-features";
+    return false;
+  }  // FeatureClassPtrs::max_features_certain()
+
+
+private:
+
+  //! prune_task{} prunes one feature class, numbering its features from 0
+  //
+  struct prune_task : public thread_pool::task {
+    FeatureClass* fc;
+    size_type mincount;
+    size_type nkept;
+
+    prune_task(FeatureClass* fc, size_type mincount) 
+      : fc(fc), mincount(mincount), nkept(0) { }
+
+    virtual void run() {
+      if (profile_flag || tracer::enabled()) {
+	profile_scope ps(fc->profile.prune);
+	trace_span ts(fc->identifier(), "prune", true);
+	nkept = fc->prune(mincount);
+      }
+      else
+	nkept = fc->prune(mincount);
+    }  // FeatureClassPtrs::prune_task::run()
+  };  // FeatureClassPtrs::prune_task{}
+
+  //! renumber_task{} moves one feature class's ids up to nextid and
+  //! leaves its part of the feature map in text
+  //
+  struct renumber_task : public thread_pool::task {
+    FeatureClass* fc;
+    Id nextid;
+    std::string text;
+
+    renumber_task(FeatureClass* fc) : fc(fc), nextid(0) { }
+
+    virtual void run() {
+      if (profile_flag || tracer::enabled()) {
+	profile_scope ps(fc->profile.prune);
+	trace_span ts(fc->identifier(), "renumber", true);
+	renumber_and_print();
+      }
+      else
+	renumber_and_print();
+    }  // FeatureClassPtrs::renumber_task::run()
+
+    void renumber_and_print() {
+      fc->renumber(nextid);
+      std::ostringstream os;
+      fc->print_feature_ids(os);
+      text = os.str();
+    }  // FeatureClassPtrs::renumber_task::renumber_and_print()
+
+    //! write() writes text to os and frees it
+    //
+    void write(std::ostream& os) {
+      os.write(text.data(), text.size());
+      std::string().swap(text);
+    }  // FeatureClassPtrs::renumber_task::write()
+  };  // FeatureClassPtrs::renumber_task{}
+
+  //! renumber_and_write() runs tasks on nthreads threads, writing each
+  //! task's part of the feature map to os as soon as it and all the
+  //! tasks before it have finished, so that at most the parts that
+  //! finished early are held in memory at once
+  //
+  static void renumber_and_write(std::vector<renumber_task>& tasks, size_t nthreads,
+				 std::ostream& os) {
+    if (nthreads <= 1 || tasks.size() <= 1) {
+      foreach (std::vector<renumber_task>, it, tasks) {
+	it->run();
+	it->write(os);
+      }
+      return;
+    }
+    thread_pool pool(std::min(nthreads, tasks.size()));
+    std::vector<thread_pool::group> groups(tasks.size());
+    for (size_type i = 0; i < tasks.size(); ++i)
+      pool.submit(&tasks[i], groups[i]);
+    for (size_type i = 0; i < tasks.size(); ++i) {
+      pool.wait(groups[i]);
+      tasks[i].write(os);
+    }
+  }  // FeatureClassPtrs::renumber_and_write()
+
+  //! run_tasks() runs tasks on a pool of nthreads threads, or in this
+  //! thread if nthreads is 1
+  //
+  template <typename Tasks>
+  static void run_tasks(Tasks& tasks, size_t nthreads) {
+    if (nthreads <= 1 || tasks.size() <= 1) 
+      foreach (typename Tasks, it, tasks)
+	it->run();
+    else {
+      thread_pool pool(std::min(nthreads, tasks.size()));
+      foreach (typename Tasks, it, tasks)
+	pool.submit(&*it);
+      pool.wait();
+    }
+  }  // FeatureClassPtrs::run_tasks()
+
+public:
 
   //! prune_and_renumber() prunes all features that occur in less than
   //! mincount sentences, and then assigns them a number starting at 1.
+  //! The feature classes are pruned on nthreads threads; each class's
+  //! Id range is the sum of the sizes of the classes before it, so the
+  //! ids and the feature map written to os are the same whatever
+  //! nthreads is.  Each class's part of the map is written as soon as
+  //! it and the classes before it are done.  Allocation tracking
+  //! (--allocs) counts only the calling thread, and the shared feature
+  //! dictionary can't be changed by several threads at once, so either
+  //! forces nthreads to 1.
   //
-  Id prune_and_renumber(size_type mincount=5, std::ostream& os=std::cout) {
+  Id prune_and_renumber(size_type mincount=5, std::ostream& os=std::cout, 
+			size_t nthreads=1) {
+    stats.start("prune");
+    alloc_tracker::scope as(alloc_tracker::phase, stats.allocs);
+    trace_span ts("prune", "phase", true);
+    if (alloc_tracker::enabled || shared_feature_dictionary::enabled)
+      nthreads = 1;
+
+    std::vector<prune_task> prune_tasks;
+    std::vector<renumber_task> renumber_tasks;
+    cforeach (FeatureClassPtrs, it, *this) {
+      prune_tasks.push_back(prune_task(*it, mincount));
+      renumber_tasks.push_back(renumber_task(*it));
+    }
+    run_tasks(prune_tasks, nthreads);
+    if (shared_feature_dictionary::enabled)
+      shared_feature_dictionary::global().compact();
+
     Id nextid = 0;
-    cforeach (FeatureClassPtrs, it, *this)
-      nextid = (*it)->prune_and_renumber(mincount, nextid, os);
+    for (size_type i = 0; i < prune_tasks.size(); ++i) {
+      renumber_tasks[i].nextid = nextid;
+      nextid += prune_tasks[i].nkept;
+    }
+    renumber_and_write(renumber_tasks, nthreads, os);
+    mincounts.assign(1, mincount);
+    threshold_ids.assign(1, Ids());
     return nextid;
   }  // FeatureClassPtrs::prune_and_renumber()
 
+
+  //! mincounts holds the pruning thresholds: mincounts[0] is the one
+  //! prune_and_renumber() applied, and add_threshold() adds the rest.
+  //! threshold_ids[t] translates the ids that prune_and_renumber()
+  //! assigned into the ids at threshold mincounts[t] (threshold_ids[0]
+  //! is empty, as those ids are unchanged).
+  //
+  std::vector<size_type> mincounts;
+  std::vector<Ids> threshold_ids;
+
+  //! add_threshold() adds a pruning threshold mincount, which must be
+  //! at least the one prune_and_renumber() applied, without counting
+  //! the features again: the features that occur in at least mincount
+  //! sentences are numbered from 0 in the order of their current ids,
+  //! just as prune_and_renumber(mincount) would have numbered them.
+  //! Their feature map is written to os, and the number of features
+  //! kept is returned.  From then on write_features() writes one
+  //! feature file per threshold.
+  //
+  Id add_threshold(size_type mincount, std::ostream& os) {
+    if (mincounts.empty() || mincount < mincounts[0]) {
+      std::cerr << "## Error in FeatureClassPtrs::add_threshold(): threshold " << mincount
+		<< " is lower than the pruning threshold" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    mincounts.push_back(mincount);
+    threshold_ids.push_back(Ids());
+    Ids& ids = threshold_ids.back();
+    Id nextid = 0;
+    cforeach (FeatureClassPtrs, it, *this) 
+      cforeach (Ids, cit, (*it)->kept_counts)
+	ids.push_back(*cit >= mincount ? nextid++ : no_id);
+    cforeach (FeatureClassPtrs, it, *this)
+      (*it)->print_feature_ids(os, ids);
+    return nextid;
+  }  // FeatureClassPtrs::add_threshold()
+
+  //! threshold_filename() inserts ".s<mincount>" into filename before
+  //! its compression suffix (.gz or .bz2), or replaces the compression
+  //! suffix with newsuffix if that isn't NULL; e.g., train.gz becomes
+  //! train.s5.gz, or train.s5.map with newsuffix ".map".
+  //
+  static std::string threshold_filename(const std::string& filename, size_type mincount,
+					const char* newsuffix = NULL) {
+    std::string::size_type dot = filename.rfind('.');
+    if (dot == std::string::npos 
+	|| (strcasecmp(filename.c_str() + dot, ".gz") 
+	    && strcasecmp(filename.c_str() + dot, ".bz2")))
+      dot = filename.size();
+    std::ostringstream os;
+    os << filename.substr(0, dot) << ".s" << mincount
+       << (newsuffix ? newsuffix : filename.c_str() + dot);
+    return os.str();
+  }  // FeatureClassPtrs::threshold_filename()
+
+
+  //! prune_zero_weights() drops every feature with zero weight in ws
+  //! from the feature classes' dictionaries, and deletes the feature
+  //! classes left with no features at all, so that best_parse() and
+  //! write_ranked_trees() only compute features that affect the score.
+  //! The features' values (and hence the parse scores) are unchanged.
+  //! It returns the number of features kept.
+  //
+  Id prune_zero_weights(const Floats& ws) {
+    Id nkept = 0;
+    iterator out = begin();
+    foreach (FeatureClassPtrs, it, *this) {
+      size_type n = (*it)->prune_zero_weights(ws);
+      if (n == 0)
+	delete *it;
+      else {
+	*out++ = *it;
+	nkept += n;
+      }
+    }
+    erase(out, end());
+    if (shared_feature_dictionary::enabled)
+      shared_feature_dictionary::global().compact();
+    return nkept;
+  }  // FeatureClassPtrs::prune_zero_weights()
+
   
   //! write_features() maps a tree data file into a feature
   //! data file.  This is used to prepare a feature counts
-  //! file from a tree data file.
+  //! file from a tree data file.  If there are no gold trees
+  //! (see sp_corpus_type::nogold()) the G=, P= and W= fields
+  //! are omitted.  The sentences and parses read are counted in
+  //! st (by default stats).  Once the features have been pruned
+  //! the feature classes are read-only, so several data sets can
+  //! be written at once, each with its own st, and with a pool the
+  //! sentences' feature values are computed on it (see schedule()).
+  //! If add_threshold()
+  //! has added thresholds, the feature values are computed once and
+  //! a file is written for each threshold, named by
+  //! threshold_filename().
   //
   void write_features(const char* parseincmd, const char* goldincmd,
 		      const char* outfile) {
+    write_features(parseincmd, goldincmd, outfile, stats);
+  }  // FeatureClassPtrs::write_features()
+
+  void write_features(const char* parseincmd, const char* goldincmd,
+		      const char* outfile, phase_stats& st, 
+		      thread_pool* pool = NULL) const {
+
+    // one output per threshold; the feature values are computed once
+    // and each output's ids are translated through its threshold_ids
+
+    std::vector<threshold_output> outs;
+    threshold_outputs(outfile, outs);
+    foreach (std::vector<threshold_output>, ot, outs)
+      ot->lines = ot->out = popen_output(ot->filename.c_str());
+
+    sentence_source source(parseincmd, goldincmd, st);
+    if (source.goldin)
+      foreach (std::vector<threshold_output>, ot, outs)
+	fprintf(ot->out, "S=%u\n", unsigned(source.nsentences));
+    else   // the number of sentences isn't known until they've all been read
+      foreach (std::vector<threshold_output>, ot, outs) {
+	ot->lines = tmpfile();
+	if (ot->lines == NULL) {
+	  std::cerr << "## Error: can't create temporary file for " << ot->filename << std::endl;
+	  exit(EXIT_FAILURE);
+	}
+      }
+
+    st.start(outfile);
+    alloc_tracker::scope as(alloc_tracker::phase, st.allocs);
+    trace_span ts(outfile, "phase", true);
+
+    write_sentences(source, outs, pool);
+
+    if (!source.goldin)
+      foreach (std::vector<threshold_output>, ot, outs) {
+	fprintf(ot->out, "S=%u\n", unsigned(source.nread));
+	rewind(ot->lines);
+	copy_lines(ot->lines, ot->out, std::numeric_limits<size_type>::max());
+	fclose(ot->lines);
+      }
+    source.close();
+    foreach (std::vector<threshold_output>, ot, outs)
+      pclose(ot->out);
+    st.stop();
+  }  // FeatureClassPtrs::write_features()
+
+private:
+
+  //! threshold_output{} is the feature file written for one threshold
+  //
+  struct threshold_output {
+    std::string filename;
+    const Ids* ids;   // translates the ids, or NULL to leave them alone
+    FILE* out;
+    FILE* lines;      // where the sentence lines are written
 
+    threshold_output() : ids(NULL), out(NULL), lines(NULL) { }
+  };  // FeatureClassPtrs::threshold_output{}
+
+  //! threshold_outputs() sets outs to the outputs for the data set
+  //! written to outfile, one per threshold (see add_threshold())
+  //
+  void threshold_outputs(const char* outfile, std::vector<threshold_output>& outs) const {
+    outs.resize(std::max(mincounts.size(), size_t(1)));
+    for (size_type t = 0; t < outs.size(); ++t) {
+      outs[t].filename = mincounts.size() > 1 
+	? threshold_filename(outfile, mincounts[t]) : outfile;
+      if (t < threshold_ids.size() && !threshold_ids[t].empty())
+	outs[t].ids = &threshold_ids[t];
+    }
+  }  // FeatureClassPtrs::threshold_outputs()
+
+  //! copy_lines() copies up to n lines from in to out, returning the
+  //! number copied
+  //
+  static size_type copy_lines(FILE* in, FILE* out, size_type n) {
+    char buffer[BUFSIZ];
+    size_type ncopied = 0;
+    while (ncopied < n && fgets(buffer, sizeof(buffer), in) != NULL) {
+      fputs(buffer, out);
+      if (buffer[strlen(buffer)-1] == '\n')
+	++ncopied;
+    }
+    return ncopied;
+  }  // FeatureClassPtrs::copy_lines()
+
+  //! count_lines() returns the number of lines in fp, which it
+  //! leaves rewound
+  //
+  static size_type count_lines(FILE* fp) {
+    rewind(fp);
+    char buffer[BUFSIZ];
+    size_type nlines = 0;
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+      nlines += std::count(buffer, buffer + n, '\n');
+    rewind(fp);
+    return nlines;
+  }  // FeatureClassPtrs::count_lines()
+
+  //! popen_output() opens a pipe that writes outfile, compressing it
+  //! if its suffix is .gz or .bz2
+  //
+  static FILE* popen_output(const char* outfile) {
     const char* filesuffix = strrchr(outfile, '.');
     std::string command(filesuffix != NULL
 						? (strcasecmp(filesuffix, ".bz2") 
@@ -571,116 +1460,645 @@ public:
       std::cerr << "## Error: can't popen command " << command << std::endl;
       exit(EXIT_FAILURE);
     }
-    command.clear();
+    return out;
+  }  // FeatureClassPtrs::popen_output()
 
-    FILE* parsein = popen(parseincmd, "r");
+  //! class_values() adds the values of the features of the classes
+  //! [begin, end) on sentence s to p_i_v
+  //
+  void class_values(const sp_sentence_type& s, Id_Floats& p_i_v,
+		    size_type begin, size_type end) const {
+    if (profile_flag || tracer::active())
+      for (size_type c = begin; c < end; ++c) {
+	FeatureClass* fc = (*this)[c];
+	profile_scope ps(fc->profile.values);
+	alloc_tracker::scope as(alloc_tracker::featureclass, fc->profile.values_allocs);
+	trace_span ts(fc->identifier(), "values");
+	fc->feature_values(s, p_i_v);
+      }
+    else
+      for (size_type c = begin; c < end; ++c)
+	(*this)[c]->feature_values(s, p_i_v);
+  }  // FeatureClassPtrs::class_values()
 
-    if (parsein == NULL) {
-      std::cerr << "## Error: can't popen parseincmd = " << parseincmd << std::endl;
-      exit(EXIT_FAILURE);
+  //! class_group_task{} computes the values of the features of the
+  //! classes [begin, end) on one sentence
+  //
+  struct class_group_task : public thread_pool::task {
+    const FeatureClassPtrs* fcps;
+    const sp_sentence_type* sentence;
+    size_type index;   // the sentence's index, for tracing
+    size_type begin, end;
+    Id_Floats p_i_v;
+
+    class_group_task() : fcps(NULL), sentence(NULL), index(0), begin(0), end(0) { }
+
+    virtual void run() {
+      trace_sentence tsen(index);
+      p_i_v.clear();
+      p_i_v.resize(sentence->nparses());
+      fcps->class_values(*sentence, p_i_v, begin, end);
+    }  // FeatureClassPtrs::class_group_task::run()
+  };  // FeatureClassPtrs::class_group_task{}
+
+  //! sentence_task{} computes the feature values of one sentence.  If
+  //! ngroups > 1 the feature classes are split into ngroups groups,
+  //! and all but the first are forked onto pool as class_group_task{}s.
+  //
+  struct sentence_task : public thread_pool::task {
+    const FeatureClassPtrs* fcps;
+    thread_pool* pool;
+    sp_sentence_type sentence;
+    size_type index;      // the sentence's index in its data set
+    double cost;          // the estimated cost of run()
+    size_type ngroups;
+    Id_Floats p_i_v;
+    std::vector<class_group_task> groups;
+
+    sentence_task(const FeatureClassPtrs* fcps, thread_pool* pool) 
+      : fcps(fcps), pool(pool), index(0), cost(0), ngroups(1) {
+      sentence.keep_raw_trees = false;  // feature values only need the sptrees
     }
 
-    FILE* goldin = popen(goldincmd, "r");
+    virtual void run() {
+      trace_sentence tsen(index);
+      trace_span ts("sentence", "sentence");
+      p_i_v.clear();                     // Clear feature-counts
+      p_i_v.resize(sentence.nparses());
+      if (ngroups <= 1 || pool == NULL) {
+	fcps->class_values(sentence, p_i_v, 0, fcps->size());
+	return;
+      }
+      groups.resize(ngroups);
+      thread_pool::group g;
+      for (size_type k = 0; k < ngroups; ++k) {
+	class_group_task& cg = groups[k];
+	cg.fcps = fcps;
+	cg.sentence = &sentence;
+	cg.index = index;
+	cg.begin = k*fcps->size()/ngroups;
+	cg.end = (k+1)*fcps->size()/ngroups;
+	if (k > 0)
+	  pool->submit(&cg, g);
+      }
+      fcps->class_values(sentence, p_i_v, groups[0].begin, groups[0].end);
+      pool->wait(g);
+      // later classes have larger ids, so each group's values go at the end
+      for (size_type k = 1; k < ngroups; ++k)
+	for (size_type j = 0; j < p_i_v.size(); ++j) {
+	  Id_Float& i_v = p_i_v[j];
+	  cforeach (Id_Float, it, groups[k].p_i_v[j])
+	    i_v.insert(i_v.end(), *it);
+	}
+    }  // FeatureClassPtrs::sentence_task::run()
+  };  // FeatureClassPtrs::sentence_task{}
+
+  typedef std::vector<sentence_task*> sentence_tasks;
+
+  //! shard{} selects the sentences of a data set that one of nshards
+  //! worker processes handles: the blocks of block_size consecutive
+  //! sentences are dealt out to the shards in turn, so that costly
+  //! stretches of the data are shared out too
+  //
+  struct shard {
+    size_type index, nshards, block_size;
+
+    shard(size_type index, size_type nshards, size_type block_size = 64)
+      : index(index), nshards(nshards), block_size(block_size) { }
+
+    bool contains(size_type i) const { return (i / block_size) % nshards == index; }
+  };  // FeatureClassPtrs::shard{}
+
+  //! sentence_source{} reads the sentences of a data set into
+  //! sentence_task{}s, counting them in st.  With a shard it skips
+  //! the sentences that belong to other shards.
+  //
+  struct sentence_source {
+    const char* parseincmd;
+    const char* goldincmd;
+    FILE* parsein;
+    FILE* goldin;          // NULL if there are no gold trees
+    size_type nsentences;  // the number of sentences, if there are gold trees
+    size_type nread;       // the number of sentences read or skipped
+    phase_stats& st;
+    const shard* sh;
+
+    sentence_source(const char* parseincmd, const char* goldincmd, phase_stats& st,
+		    const shard* sh = NULL)
+      : parseincmd(parseincmd), goldincmd(goldincmd), parsein(NULL), goldin(NULL),
+	nsentences(std::numeric_limits<size_type>::max()), nread(0), st(st), sh(sh) 
+    {
+      parsein = popen(parseincmd, "r");
+      if (parsein == NULL) {
+	std::cerr << "## Error: can't popen parseincmd = " << parseincmd << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      if (sp_corpus_type::nogold(goldincmd))
+	return;
+      goldin = popen(goldincmd, "r");
+      if (!goldin) {
+	std::cerr << "## Error: can't popen goldincmd = " << goldincmd << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      unsigned int n;
+      int nread = fscanf(goldin, " %u ", &n);
+      if (nread != 1) {
+	std::cerr << "## Failed to read nsentences from " 
+		  << goldincmd << std::endl;
+	exit(EXIT_FAILURE);
+      }
+      nsentences = n;
+    }  // FeatureClassPtrs::sentence_source::sentence_source()
+
+    void close() {
+      if (goldin)
+	pclose(goldin);
+      pclose(parsein);
+    }  // FeatureClassPtrs::sentence_source::close()
+
+    //! read() reads up to tasks.size() sentences into tasks, returning
+    //! the number read
+    //
+    size_type read(sentence_tasks& tasks) {
+      size_type n = 0;
+      for ( ; n < tasks.size() && nread < nsentences 
+	      && (goldin || sp_corpus_type::more_sentences(parsein)); ++nread) {
+	if (sh && !sh->contains(nread)) {
+	  if (!sp_sentence_type::skip(parsein, goldin))
+	    read_error();
+	  continue;
+	}
+	sentence_task& t = *tasks[n++];
+	t.index = nread;
+	trace_sentence tsen(nread);
+	trace_span ts("read", "read");
+	if (!t.sentence.read(parsein, goldin, lowercase_flag))
+	  read_error();
+	count_sentence(t.sentence, st);
+      }
+      return n;
+    }  // FeatureClassPtrs::sentence_source::read()
 
-    if (!goldin) {
-      std::cerr << "## Error: can't popen goldincmd = " << goldincmd << std::endl;
+    void read_error() const {
+      std::cerr << "## Error reading sentence " << nread+1  
+		<< " from \"" << parseincmd << "\" and \"" << (goldin ? goldincmd : "-") 
+		<< "\"" << std::endl;
       exit(EXIT_FAILURE);
+    }  // FeatureClassPtrs::sentence_source::read_error()
+  };  // FeatureClassPtrs::sentence_source{}
+
+  //! write_sentences() computes the feature values of source's
+  //! sentences and writes their lines to each of outs.  While the
+  //! pool (if any) computes one batch's feature values, this thread
+  //! reads the next; each batch is written in order once it's done.
+  //
+  void write_sentences(sentence_source& source, std::vector<threshold_output>& outs,
+		       thread_pool* pool) const {
+    bool gold = source.goldin != NULL;
+    size_type batchsize = pool ? 64*pool->nthreads() : 1;
+    sentence_tasks current(batchsize), next(batchsize);
+    for (size_type k = 0; k < batchsize; ++k) {
+      current[k] = new sentence_task(this, pool);
+      next[k] = new sentence_task(this, pool);
+    }
+    
+    size_type ncurrent = source.read(current);
+    while (ncurrent > 0) {
+      thread_pool::group g;
+      schedule(current, ncurrent, pool, g);
+      size_type nnext = source.read(next);
+      if (pool)
+	pool->wait(g);
+      for (size_type k = 0; k < ncurrent; ++k) {
+	trace_sentence tsen(current[k]->index);
+	trace_span ts_write("write", "output");
+	cforeach (std::vector<threshold_output>, ot, outs)
+	  write_sentence(current[k]->sentence, current[k]->p_i_v, gold, ot->lines, ot->ids);
+      }
+      current.swap(next);
+      ncurrent = nnext;
     }
 
-    unsigned int nsentences;
-    int nread = fscanf(goldin, " %u ", &nsentences);
-    if (nread != 1) {
-      std::cerr << "## Failed to read nsentences from " 
-		<< goldincmd << std::endl;
-      exit(EXIT_FAILURE);
+    for (size_type k = 0; k < batchsize; ++k) {
+      delete current[k];
+      delete next[k];
     }
-    fprintf(out, "S=%u\n", nsentences);
+  }  // FeatureClassPtrs::write_sentences()
 
-    sp_sentence_type sentence;
-    Id_Floats p_i_v;
-    for (size_type i = 0; i < nsentences; ++i) {
-      if (!sentence.read(parsein, goldin, lowercase_flag)) {
-	std::cerr << "## Error reading sentence " << i+1  
-		  << " from \"" << parseincmd << "\" and \"" << goldincmd << "\""
-		  << std::endl;
+  //! sentence_cost() estimates the time feature_values() takes on s,
+  //! which grows with the number of parses times their length
+  //
+  static double sentence_cost(const sp_sentence_type& s) {
+    if (s.nparses() == 0 || s.parses[0].parse == NULL)
+      return 0;
+    const sptree_label& root = s.parses[0].parse->label;
+    return double(s.nparses()) * (root.right - root.left + 1);
+  }  // FeatureClassPtrs::sentence_cost()
+
+  //! schedule() runs the first n of tasks, on pool in g if pool isn't
+  //! NULL.  Sentences' costs vary by orders of magnitude, so they are
+  //! submitted most costly first: each worker runs the tasks it
+  //! submitted newest first, and the other workers steal the oldest,
+  //! so the costly sentences start early and the cheap ones fill in
+  //! the tail.  A sentence costing more than a quarter of one thread's
+  //! share of the batch also has its feature classes split into
+  //! groups that can run on different threads.
+  //
+  void schedule(sentence_tasks& tasks, size_type n, thread_pool* pool, 
+		thread_pool::group& g) const {
+    if (pool == NULL) {
+      for (size_type k = 0; k < n; ++k)
+	tasks[k]->run();
+      return;
+    }
+    sentence_tasks sorted(tasks.begin(), tasks.begin() + n);
+    double total = 0;
+    cforeach (sentence_tasks, it, sorted) {
+      (*it)->cost = sentence_cost((*it)->sentence);
+      total += (*it)->cost;
+    }
+    double target = total / (4*pool->nthreads());
+    cforeach (sentence_tasks, it, sorted) {
+      (*it)->ngroups = 1;
+      if ((*it)->cost > target && target > 0)
+	(*it)->ngroups = std::min(std::min(pool->nthreads(), size()),
+				  size_type((*it)->cost / target));
+    }
+    std::stable_sort(sorted.begin(), sorted.end(), costlier);
+    cforeach (sentence_tasks, it, sorted)
+      pool->submit(*it, g);
+  }  // FeatureClassPtrs::schedule()
+
+  static bool costlier(const sentence_task* t1, const sentence_task* t2) {
+    return t1->cost > t2->cost;
+  }  // FeatureClassPtrs::costlier()
+
+  //! write_sentence() writes sentence's line of a feature file to
+  //! lines, translating the ids in p_i_v through ids if it isn't NULL
+  //
+  static void write_sentence(const sp_sentence_type& sentence, const Id_Floats& p_i_v,
+			     bool gold, FILE* lines, const Ids* ids) {
+    // sentence.read() has already scored each parse against the gold tree
+    if (gold)
+      fprintf(lines, "G=%u ", unsigned(sentence.gold_nedges));
+    fprintf(lines, "N=%u", unsigned(sentence.parses.size()));
+    for (size_type j = 0; j < sentence.parses.size(); ++j) {
+      const sp_parse_type& p = sentence.parses[j];
+      if (gold)
+	fprintf(lines, " P=%u W=%u", unsigned(p.nedges), unsigned(p.ncorrect));
+      const Id_Float& i_v = p_i_v[j];
+      cforeach (Id_Float, it, i_v) {
+	Id id = ids ? (*ids)[it->first] : it->first;
+	if (id == no_id)
+	  continue;
+	if (it->second == 1)
+	  fprintf(lines, " " SCANF_ID_TYPE, id);
+	else 
+	  fprintf(lines, " " SCANF_ID_TYPE "=%g", id, it->second);
+      }
+      fprintf(lines, ",");
+    }
+    fprintf(lines, "\n");
+  }  // FeatureClassPtrs::write_sentence()
+
+  //! write_task{} writes one data set's features, reporting when it
+  //! starts and its stats when it finishes
+  //
+  struct write_task : public thread_pool::task {
+    const FeatureClassPtrs* fcps;
+    const char* parseincmd;
+    const char* goldincmd;
+    const char* outfile;
+    thread_pool* pool;   // computes the sentences' feature values, or NULL
+    phase_stats stats;
+
+    write_task(const FeatureClassPtrs* fcps, const char* parseincmd, 
+	       const char* goldincmd, const char* outfile, thread_pool* pool)
+      : fcps(fcps), parseincmd(parseincmd), goldincmd(goldincmd), outfile(outfile),
+	pool(pool) { }
+
+    virtual void run() {
+      std::ostringstream os;
+      os << "# reading from \"" << parseincmd << "\" and \"" << goldincmd 
+	 << "\", writing to " << outfile << '\n';
+      write_message(os.str());
+      fcps->write_features(parseincmd, goldincmd, outfile, stats, pool);
+      os.str("");
+      os << "# " << stats << ", usage " << resource_usage() << '\n';
+      write_message(os.str());
+    }  // FeatureClassPtrs::write_task::run()
+  };  // FeatureClassPtrs::write_task{}
+
+public:
+
+  //! write_features() writes the feature files of nsets data sets,
+  //! given in files as (parse command, gold command, output file)
+  //! triples as on extract-spfeatures' command line, on a pool of
+  //! nthreads threads.  The data sets are read concurrently, and the
+  //! pool's threads compute the feature values of all of their
+  //! sentences, so the threads stay busy even if there is only one
+  //! set.  Each set's stats are written to std::cerr as it finishes.
+  //! Profiling (-p) isn't thread-safe, so it forces nthreads to 1.
+  //
+  void write_features(const char* const* files, size_t nsets, size_t nthreads) {
+    if (profile_flag)
+      nthreads = 1;
+    std::vector<write_task> write_tasks;
+    if (nthreads <= 1) {
+      for (size_t i = 0; i < nsets; ++i)
+	write_tasks.push_back(write_task(this, files[3*i], files[3*i+1], files[3*i+2], NULL));
+      run_tasks(write_tasks, 1);
+    }
+    else {
+      thread_pool pool(nthreads);
+      for (size_t i = 0; i < nsets; ++i)
+	write_tasks.push_back(write_task(this, files[3*i], files[3*i+1], files[3*i+2], &pool));
+      foreach (std::vector<write_task>, it, write_tasks)
+	pool.submit(&*it);
+      pool.wait();
+    }
+  }  // FeatureClassPtrs::write_features()
+
+  //! write_features_forked() writes the feature files of nsets data
+  //! sets like write_features(files, nsets, nthreads), but on nprocs
+  //! forked worker processes rather than on threads.  The workers
+  //! share the pruned feature classes copy-on-write, so none of the
+  //! symbol tables, tree readers and caches need be thread-safe.
+  //! Worker k computes the lines of every set's k'th shard into
+  //! temporary files, and the parent then interleaves the shards'
+  //! blocks into the feature files in their original order.  No
+  //! other threads may be running when it is called.
+  //
+  void write_features_forked(const char* const* files, size_t nsets, size_t nprocs) {
+    std::vector<std::vector<std::vector<FILE*> > > lines(nsets);  // [set][output][shard]
+    std::vector<std::vector<threshold_output> > outs(nsets);
+    for (size_t i = 0; i < nsets; ++i) {
+      threshold_outputs(files[3*i+2], outs[i]);
+      lines[i].resize(outs[i].size());
+      for (size_t t = 0; t < outs[i].size(); ++t)
+	for (size_t k = 0; k < nprocs; ++k) {
+	  FILE* fp = tmpfile();
+	  if (fp == NULL) {
+	    std::cerr << "## Error: can't create temporary file for " 
+		      << outs[i][t].filename << std::endl;
+	    exit(EXIT_FAILURE);
+	  }
+	  lines[i][t].push_back(fp);
+	}
+    }
+
+    std::cout << std::flush;
+    std::cerr << std::flush;
+    fflush(NULL);
+    std::vector<pid_t> pids;
+    for (size_t k = 0; k < nprocs; ++k) {
+      pid_t pid = fork();
+      if (pid < 0) {
+	std::cerr << "## Error: can't fork worker " << k << std::endl;
 	exit(EXIT_FAILURE);
       }
-      precrec_type::edges goldedges(sentence.gold);
-      fprintf(out, "G=%u N=%u", goldedges.nedges(), unsigned(sentence.parses.size()));
-      p_i_v.clear();                     // Clear feature-counts
-      p_i_v.resize(sentence.nparses());
-      cforeach (FeatureClassPtrs, it, *this)
-	(*it)->feature_values(sentence, p_i_v);
-
-      for (size_type j = 0; j < sentence.parses.size(); ++j) {
-	const sp_parse_type& p = sentence.parses[j];
-	precrec_type pr(goldedges, p.parse);
-	fprintf(out, " P=%u W=%u", pr.ntest, pr.ncommon);
-	const Id_Float& i_v = p_i_v[j];
-	cforeach (Id_Float, it, i_v) 
-	  if (it->second == 1)
-	    fprintf(out, " " SCANF_ID_TYPE, it->first);
-	  else 
-	    fprintf(out, " " SCANF_ID_TYPE "=%g", it->first, it->second);
-	fprintf(out, ",");
+      if (pid == 0) {    // worker k
+	for (size_t i = 0; i < nsets; ++i) {
+	  std::vector<FILE*> shard_lines;
+	  for (size_t t = 0; t < lines[i].size(); ++t)
+	    shard_lines.push_back(lines[i][t][k]);
+	  phase_stats st;
+	  write_shard(files[3*i], files[3*i+1], files[3*i+2], shard(k, nprocs), 
+		      shard_lines, st);
+	  std::ostringstream os;
+	  os << "# shard " << k+1 << " of " << nprocs << ": " << st 
+	     << ", usage " << resource_usage() << '\n';
+	  write_message(os.str());
+	}
+	std::cerr << std::flush;
+	_exit(EXIT_SUCCESS);
       }
-      fprintf(out, "\n");
+      pids.push_back(pid);
     }
 
-    pclose(goldin);
-    pclose(parsein);
-    pclose(out);
-  }  // FeatureClassPtrs::write_features()
+    bool failed = false;
+    foreach (std::vector<pid_t>, it, pids) {
+      int status;
+      if (waitpid(*it, &status, 0) != *it || !WIFEXITED(status) 
+	  || WEXITSTATUS(status) != EXIT_SUCCESS)
+	failed = true;
+    }
+    if (failed) {
+      std::cerr << "## Error: a worker process failed" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < nsets; ++i)
+      for (size_t t = 0; t < outs[i].size(); ++t) {
+	std::vector<FILE*>& shards = lines[i][t];
+	size_type nsentences = 0;
+	cforeach (std::vector<FILE*>, it, shards)
+	  nsentences += count_lines(*it);
+	FILE* out = popen_output(outs[i][t].filename.c_str());
+	fprintf(out, "S=%u\n", unsigned(nsentences));
+	shard sh(0, nprocs);
+	for (size_type n = 0; n < nsentences; ) 
+	  for (size_t k = 0; k < nprocs; ++k)
+	    n += copy_lines(shards[k], out, sh.block_size);
+	pclose(out);
+	cforeach (std::vector<FILE*>, it, shards)
+	  fclose(*it);
+      }
+  }  // FeatureClassPtrs::write_features_forked()
+
+private:
+
+  //! write_shard() writes the lines of shard sh of a data set (without
+  //! the S= line) to lines, one file per threshold (see write_features())
+  //
+  void write_shard(const char* parseincmd, const char* goldincmd, const char* outfile,
+		   const shard& sh, const std::vector<FILE*>& lines, phase_stats& st) const {
+    std::vector<threshold_output> outs;
+    threshold_outputs(outfile, outs);
+    for (size_type t = 0; t < outs.size(); ++t)
+      outs[t].lines = lines[t];
+    sentence_source source(parseincmd, goldincmd, st, &sh);
+    st.start(outfile);
+    write_sentences(source, outs, NULL);
+    source.close();
+    foreach (std::vector<threshold_output>, ot, outs)
+      if (fflush(ot->lines) != 0) {
+	std::cerr << "## Error: can't write the lines of " << ot->filename << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    st.stop();
+  }  // FeatureClassPtrs::write_shard()
+
+public:
+
+  //! write_profile() writes a table of the profiling counters of
+  //! each feature class to os, most expensive feature class first.
+  //! Times are in seconds; "generated" counts (feature, parse) pairs
+  //! seen while counting, "distinct" and "kept" count features
+  //! before and after pruning, and the byte columns estimate the
+  //! dictionary size before pruning and now.  If allocations are
+  //! being tracked the allocations, bytes and tree nodes allocated
+  //! by each feature class are appended.
+  //
+  std::ostream& write_profile(std::ostream& os) const {
+    typedef std::pair<double,const FeatureClass*> WFC;
+    typedef std::vector<WFC> WFCs;
+    WFCs wfcs;
+    cforeach (FeatureClassPtrs, it, *this)
+      wfcs.push_back(WFC(-(*it)->profile.wall(), *it));
+    std::sort(wfcs.begin(), wfcs.end());
+
+    featureclass_profile total;
+    size_t total_bytes = 0;
+    os << "# profile\tclass\textract_calls\textract_wall\textract_cpu"
+      "\tvalues_calls\tvalues_wall\tvalues_cpu\tprune_wall"
+      "\tgenerated\tdistinct\tkept\tcounted_bytes\tbytes";
+    if (alloc_tracker::enabled)
+      os << "\textract_allocs\textract_alloc_bytes\textract_nodes"
+	"\tvalues_allocs\tvalues_alloc_bytes\tvalues_nodes";
+    os << '\n';
+    cforeach (WFCs, it, wfcs) {
+      const featureclass_profile& p = it->second->profile;
+      size_t bytes = it->second->dictionary_bytes();
+      write_profile_row(os, it->second->identifier(), p, bytes);
+      total.extract.calls += p.extract.calls;
+      total.extract.wall += p.extract.wall;
+      total.extract.cpu += p.extract.cpu;
+      total.values.calls += p.values.calls;
+      total.values.wall += p.values.wall;
+      total.values.cpu += p.values.cpu;
+      total.prune.wall += p.prune.wall;
+      add_allocs(total.extract_allocs, p.extract_allocs);
+      add_allocs(total.values_allocs, p.values_allocs);
+      total.ngenerated += p.ngenerated;
+      total.ndistinct += p.ndistinct;
+      total.nkept += p.nkept;
+      total.nbytes_counted += p.nbytes_counted;
+      total_bytes += bytes;
+    }
+    write_profile_row(os, "TOTAL", total, total_bytes);
+    return os << std::flush;
+  }  // FeatureClassPtrs::write_profile()
+
+private:
+  static void write_profile_row(std::ostream& os, const char* ident,
+				const featureclass_profile& p, size_t bytes) {
+    os << "# profile\t" << ident
+       << '\t' << p.extract.calls << '\t' << p.extract.wall << '\t' << p.extract.cpu
+       << '\t' << p.values.calls << '\t' << p.values.wall << '\t' << p.values.cpu
+       << '\t' << p.prune.wall
+       << '\t' << p.ngenerated << '\t' << p.ndistinct << '\t' << p.nkept
+       << '\t' << p.nbytes_counted << '\t' << bytes;
+    if (alloc_tracker::enabled)
+      os << '\t' << p.extract_allocs.nallocs << '\t' << p.extract_allocs.nbytes
+	 << '\t' << p.extract_allocs.nnodes
+	 << '\t' << p.values_allocs.nallocs << '\t' << p.values_allocs.nbytes
+	 << '\t' << p.values_allocs.nnodes;
+    os << '\n';
+  }  // FeatureClassPtrs::write_profile_row()
+
+  static void add_allocs(alloc_counter& total, const alloc_counter& c) {
+    total.nallocs += c.nallocs;
+    total.nbytes += c.nbytes;
+    total.nnodes += c.nnodes;
+  }  // FeatureClassPtrs::add_allocs()
+
+public:
 
   //! read_feature_ids() reads feature ids from is, and sets
-  //! each feature class' feature_id hash accordingly.
+  //! each feature class' feature_id hash accordingly.  It exits
+  //! with an error message if is isn't a valid feature map.
   //
   Id read_feature_ids(std::istream& is) {
+    Id maxid;
+    std::string error;
+    if (!read_feature_ids(is, maxid, error)) {
+      std::cerr << "## Error: " << error << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    return maxid;
+  }  // FeatureClassPtrs::read_feature_ids()
+
+  //! read_feature_ids(is, maxid, error) is read_feature_ids(is) for
+  //! callers that mustn't exit: it sets maxid and returns true, or
+  //! sets error and returns false if is isn't a valid feature map.
+  //
+  bool read_feature_ids(std::istream& is, Id& maxid, std::string& error) {
     typedef std::map<std::string, FeatureClass*> St_FCp;
     St_FCp fcident_fcp;
     for (iterator it = begin(); it != end(); ++it) 
       fcident_fcp[(*it)->identifier()] = *it;
 
-    Id id, maxid = 0;
-    std::string fcident;
-    while (is >> id >> fcident) {
+    maxid = 0;
+    std::string line;
+    for (size_type lineno = 1; std::getline(is, line); ++lineno) {
+      std::istringstream ls(line);
+      Id id;
+      std::string fcident;
+      if (!(ls >> id >> fcident)) {
+	if (line.find_first_not_of(" \t\r") == std::string::npos)
+	  continue;                     // blank line
+	error = "can't read feature map line " + lexical_cast<std::string>(lineno)
+	  + ": `" + line + "'";
+	return false;
+      }
       St_FCp::const_iterator it = fcident_fcp.find(fcident);
-      if (it != fcident_fcp.end()) 
-	it->second->read_feature(is, id);
-      else {
-	std::cerr << "## Error: can't find feature identifier " << fcident
-		  << " in feature list.\n"
-		  << "## best-parses incompatible with feature definition data file."
-		  << std::endl;
-	exit(EXIT_FAILURE);
+      if (it == fcident_fcp.end()) {
+	error = "can't find feature identifier " + fcident + " in feature list"
+	  " (the feature map doesn't match the feature classes)";
+	return false;
+      }
+      if (!it->second->read_feature(ls, id)) {
+	error = "malformed or duplicate feature on feature map line " 
+	  + lexical_cast<std::string>(lineno) + ": `" + line + "'";
+	return false;
       }
-      
-      is.ignore(std::numeric_limits<int>::max(), '\n');
       if (id > maxid)
 	maxid = id;
     }
-    return maxid;
+    if (is.bad()) {
+      error = "can't read feature map";
+      return false;
+    }
+    return true;
   }  // FeatureClassPtrs::read_feature_ids()
 
-  //! best_parse() returns the best parse tree from n-best parses for a sentence
+  //! parse_scores() sets scores[i] to the score, under weights ws,
+  //! of the ith parse of sentence.  Unless fused, it sums the feature
+  //! values written by feature_values() rather than scoring the
+  //! parses directly; this is slower, and is only for checking.
   //
-  template <typename Ws>
-  const tree* best_parse(const sp_sentence_type& sentence, const Ws& ws) const {
-    assert(sentence.nparses() > 0);
-
+  void parse_scores(const sp_sentence_type& sentence, const Floats& ws,
+		    Floats& scores, bool fused = true) const {
+    scores.assign(sentence.nparses(), 0);
+    if (fused) {
+      cforeach (FeatureClassPtrs, it, *this)
+	(*it)->feature_scores(sentence, ws, scores);
+      return;
+    }
     Id_Floats p_i_v(sentence.nparses());
     cforeach (FeatureClassPtrs, it, *this)
       (*it)->feature_values(sentence, p_i_v);
+    for (size_type i = 0; i < sentence.nparses(); ++i)
+      cforeach (Id_Float, ivit, p_i_v[i]) {
+	assert(ivit->first < ws.size());
+	scores[i] += ivit->second * ws[ivit->first];
+      }
+  }  // FeatureClassPtrs::parse_scores()
+
+  //! best_parse() returns the best parse tree from n-best parses for a sentence
+  //
+  const tree* best_parse(const sp_sentence_type& sentence, const Floats& ws,
+			 bool fused = true) const {
+    assert(sentence.nparses() > 0);
+
+    Floats scores;
+    parse_scores(sentence, ws, scores, fused);
 
     Float max_weight = 0;
     size_type i_max = 0;
     for (size_type i = 0; i < sentence.nparses(); ++i) {
-      const Id_Float& i_v = p_i_v[i];
-      Float w = 0;
-      cforeach (Id_Float, ivit, i_v) {
-	assert(ivit->first < ws.size());
-	w += ivit->second * ws[ivit->first];
-      }
+      Float w = scores[i];
       if (i == 0 || w > max_weight) {
 	i_max = i;
 	max_weight = w;
@@ -693,16 +2111,15 @@ public:
   //! write_ranked_trees() sorts all of the trees by their conditional
   //! probability and then writes them out in sorted order.
   //
-  template <typename Ws>
   std::ostream& write_ranked_trees(const sp_sentence_type& sentence, 
-				   const Ws& ws, std::ostream& os) const {
+				   const Floats& ws, std::ostream& os,
+				   bool fused = true) const {
     assert(sentence.nparses() > 0);
 
     os << sentence.nparses() << ' ' << sentence.label << std::endl;
 
-    Id_Floats p_i_v(sentence.nparses());
-    cforeach (FeatureClassPtrs, it, *this)
-      (*it)->feature_values(sentence, p_i_v);
+    Floats scores;
+    parse_scores(sentence, ws, scores, fused);
 
     typedef std::pair<Id,Float> IdFloat;
     typedef std::vector<IdFloat> IdFloats;
@@ -711,13 +2128,7 @@ public:
 
     for (size_type i = 0; i < sentence.nparses(); ++i) {
       idweights[i].first = i;
-      const Id_Float& i_v = p_i_v[i];
-      Float w = 0;
-      cforeach (Id_Float, ivit, i_v) {
-	assert(ivit->first < ws.size());
-	w += ivit->second * ws[ivit->first];
-      }
-      idweights[i].second = w;
+      idweights[i].second = scores[i];
     }
 
     std::sort(idweights.begin(), idweights.end(), second_greaterthan());
@@ -758,6 +2169,7 @@ public:
 };  // FeatureClassPtrs{}
 
 
+inline
 std::ostream& operator<< (std::ostream& os, const FeatureClassPtrs& fcps) {
   cforeach (FeatureClassPtrs, it, fcps)
     (*it)->print_feature_ids(os);
@@ -932,6 +2344,8 @@ public:
 class TreeFeatureClass : public FeatureClass {
 public:
 
+  static const bool tree_only = true;
+
   //! parse_featurecount() passes the tree to tree_featurecount()
   //! to analyse.
   //
@@ -3299,10 +4713,309 @@ inline void FeatureClassPtrs::features_spnn(bool nngram) {
 }  // FeatureClassPtrs::features_spnn()
 
 
-//! FeatureClassPtrs::FeatureClassPtrs() preloads a
-//! set of features.
+//! feature_class_factories{} is the name->factory table that
+//! features_matching() builds feature classes from, so that only the
+//! classes a spec selects are ever constructed.  A feature class's
+//! identifier is its name followed by its constructor's arguments, so
+//! make() can build a class from its identifier alone.  identifiers()
+//! lists the classes of features_spnn(true), in order; features_matching()
+//! asserts (once) that it covers every class of features_050902() and
+//! features_spnn(true).
+//
+struct feature_class_factories {
+  typedef std::vector<int> Fields;
+  typedef FeatureClass* (*factory)(const Fields& f);
+
+  struct entry {
+    const char* name;
+    size_type nfields;
+    factory make;
+  };  // feature_class_factories::entry{}
+
+  static FeatureClass* make_NLogP(const Fields& f) { return new NLogP(); }
+  static FeatureClass* make_RightBranch(const Fields& f) { return new RightBranch(); }
+  static FeatureClass* make_Heavy(const Fields& f) { return new Heavy(); }
+  static FeatureClass* make_CoPar(const Fields& f) { return new CoPar(f[0]); }
+  static FeatureClass* make_CoLenPar(const Fields& f) { return new CoLenPar(); }
+  static FeatureClass* make_Word(const Fields& f) { return new Word(f[0]); }
+
+  static FeatureClass* make_WProj(const Fields& f) { 
+    return new WProj(WProj::annotation_type(f[0]), f[1], f[2]);
+  }
+
+  static FeatureClass* make_Rule(const Fields& f) {
+    return new Rule(f[0], f[1], f[2], f[3], Rule::annotation_level(f[4]),
+		    Rule::annotation_level(f[5]), Rule::annotation_level(f[6]),
+		    Rule::annotation_type(f[7]));
+  }
+
+  static FeatureClass* make_NGram(const Fields& f) {
+    return new NGram(f[0], f[1], f[2], f[3], NGram::annotation_level(f[4]),
+		     NGram::annotation_level(f[5]), NGram::annotation_level(f[6]),
+		     NGram::annotation_type(f[7]));
+  }
+
+  //! NNGram's identifier puts headdir and headdist straight after fraglen
+  //
+  static FeatureClass* make_NNGram(const Fields& f) {
+    return new NNGram(f[0], f[3], f[4], f[5], NNGram::annotation_level(f[6]),
+		      NNGram::annotation_level(f[7]), NNGram::annotation_level(f[8]),
+		      NNGram::annotation_type(f[9]), f[1], f[2]);
+  }
+
+  static FeatureClass* make_NGramTree(const Fields& f) {
+    return new NGramTree(f[0], NGramTree::lexicalize_type(f[1]), f[2], f[3]);
+  }
+
+  static FeatureClass* make_HeadTree(const Fields& f) {
+    return new HeadTree(f[0], f[1], f[2], HeadTree::head_type(f[3]));
+  }
+
+  static FeatureClass* make_Heads(const Fields& f) {
+    return new Heads(f[0], f[1], f[2], Heads::head_type_type(f[3]));
+  }
+
+  static FeatureClass* make_Edges(const Fields& f) {
+    return new Edges(f[0], f[1], f[2], f[3], f[4]);
+  }
+
+  static FeatureClass* make_WordEdges(const Fields& f) {
+    return new WordEdges(f[0], f[1], f[2], f[3], f[4]);
+  }
+
+  //! find() returns the table entry for the class called name, or NULL
+  //
+  static const entry* find(const std::string& name) {
+    static const entry table[] = {
+      { "NLogP", 0, make_NLogP },
+      { "RightBranch", 0, make_RightBranch },
+      { "Heavy", 0, make_Heavy },
+      { "CoPar", 1, make_CoPar },
+      { "CoLenPar", 0, make_CoLenPar },
+      { "Word", 1, make_Word },
+      { "WProj", 3, make_WProj },
+      { "Rule", 8, make_Rule },
+      { "NGram", 8, make_NGram },
+      { "NNGram", 10, make_NNGram },
+      { "NGramTree", 4, make_NGramTree },
+      { "HeadTree", 4, make_HeadTree },
+      { "Heads", 4, make_Heads },
+      { "Edges", 5, make_Edges },
+      { "WordEdges", 5, make_WordEdges }
+    };
+    for (size_type i = 0; i < sizeof(table)/sizeof(table[0]); ++i)
+      if (name == table[i].name)
+	return &table[i];
+    return NULL;
+  }  // feature_class_factories::find()
+
+  //! make() returns a new feature class with the given identifier, or
+  //! NULL if the table has no factory for it
+  //
+  static FeatureClass* make(const std::string& identifier) {
+    std::string::size_type colon = identifier.find(':');
+    const entry* e = find(identifier.substr(0, colon));
+    if (e == NULL)
+      return NULL;
+    Fields f;
+    while (colon != std::string::npos) {
+      std::string::size_type start = colon + 1;
+      colon = identifier.find(':', start);
+      f.push_back(atoi(identifier.substr(start, colon - start).c_str()));
+    }
+    if (f.size() != e->nfields)
+      return NULL;
+    FeatureClass* fc = e->make(f);
+    if (identifier != fc->identifier()) {   // e.g., a field that isn't a number
+      delete fc;
+      return NULL;
+    }
+    return fc;
+  }  // feature_class_factories::make()
+
+  //! edges_identifiers() appends the identifiers of the Edges and
+  //! WordEdges classes of features_spnn(true) to ids, and returns it
+  //
+  static std::vector<std::string> edges_identifiers(std::vector<std::string> ids) {
+    const char* const names[] = { "Edges:", "WordEdges:" };
+    size_type maxwidth = 2, maxsumwidth = 2;
+    for (size_type n = 0; n < 2; ++n)
+      for (size_type binflag = 0; binflag < 2; ++binflag)
+	for (size_type nleftprec = 0; nleftprec <= maxwidth; ++nleftprec)
+	  for (size_type nleftsucc = 0; nleftsucc <= maxwidth; ++nleftsucc)
+	    for (size_type nrightprec = 0; nrightprec <= maxwidth; ++nrightprec)
+	      for (size_type nrightsucc = 0; nrightsucc <= maxwidth; ++nrightsucc)
+		if (nleftprec + nleftsucc + nrightprec + nrightsucc <= maxsumwidth)
+		  ids.push_back(names[n] + lexical_cast<std::string>(binflag)
+				+ ':' + lexical_cast<std::string>(nleftprec)
+				+ ':' + lexical_cast<std::string>(nleftsucc)
+				+ ':' + lexical_cast<std::string>(nrightprec)
+				+ ':' + lexical_cast<std::string>(nrightsucc));
+    return ids;
+  }  // feature_class_factories::edges_identifiers()
+
+  //! identifiers() returns the identifiers of the classes of
+  //! features_spnn(true), which include every class of the other sets
+  //
+  static const std::vector<std::string>& identifiers() {
+    static const char* const fixed[] = {
+      "NLogP", "RightBranch", "Heavy", "CoPar:0", "CoLenPar", "Word:1", "Word:2",
+      "WProj:0:0:1",
+      "Rule:0:0:0:0:0:0:0:1", "Rule:0:1:0:0:0:0:0:1", "Rule:0:0:1:0:0:0:0:1",
+      "Rule:0:0:0:1:0:0:0:1", "Rule:0:0:0:0:2:0:0:1", "Rule:0:0:0:0:0:2:0:1",
+      "Rule:0:0:0:0:2:2:0:1",
+      "NGram:1:1:0:1:0:0:0:1", "NGram:2:1:1:1:0:0:0:1", "NGram:3:1:1:1:0:0:0:1",
+      "NGram:2:1:0:0:2:0:0:1", "NGram:2:1:0:0:0:2:0:1",
+      "NNGram:1:1:1:1:0:1:0:0:0:1", "NNGram:2:1:1:1:1:1:0:0:0:1",
+      "NNGram:3:1:1:1:1:1:0:0:0:1", "NNGram:2:1:1:1:0:0:2:0:0:1",
+      "NNGram:2:1:1:1:0:0:2:2:0:1",
+      "NGramTree:2:0:1:0", "NGramTree:2:3:1:0", "NGramTree:3:2:1:0",
+      "HeadTree:1:0:0:0", "HeadTree:1:0:0:1", "HeadTree:1:1:0:1",
+      "Heads:2:0:0:0", "Heads:2:1:1:0", "Heads:2:1:1:1", "Heads:3:0:0:0"
+    };
+    static const std::vector<std::string> ids = 
+      edges_identifiers(std::vector<std::string>(fixed, fixed + sizeof(fixed)/sizeof(fixed[0])));
+    return ids;
+  }  // feature_class_factories::identifiers()
+
+  //! covers() returns true if every class of fcps is in identifiers()
+  //! and can be made by make()
+  //
+  static bool covers(const FeatureClassPtrs& fcps) {
+    const std::vector<std::string>& ids = identifiers();
+    cforeach (FeatureClassPtrs, it, fcps) {
+      if (std::find(ids.begin(), ids.end(), (*it)->identifier()) == ids.end())
+	return false;
+      FeatureClass* fc = make((*it)->identifier());
+      if (fc == NULL)
+	return false;
+      delete fc;
+    }
+    return true;
+  }  // feature_class_factories::covers()
+
+  //! covers_standard_sets() is covers() of features_050902() and of
+  //! features_spnn(true)
+  //
+  static bool covers_standard_sets() {
+    FeatureClassPtrs fcps_050902(NULL), fcps_spnn("spnn");
+    return covers(fcps_050902) && covers(fcps_spnn);
+  }  // feature_class_factories::covers()
+
+};  // feature_class_factories{}
+
+
+//! FeatureClassPtrs::features_matching() loads the feature classes
+//! whose identifier() matches spec, a list of fnmatch(3) patterns such
+//! as "Rule:0:*", "Edges:1:*" or "NGramTree:2:*" separated by commas
+//! or whitespace, or, if spec is "@file", the patterns in file (where
+//! '#' starts a comment).  The patterns are applied in order to the
+//! identifiers of the classes of features_spnn(true), which include
+//! every class of the other sets: a pattern selects the classes it
+//! matches, and a pattern starting with '!' deselects them (so
+//! "*,!Edges:*" is an ablation).  Only the selected classes are
+//! constructed, by feature_class_factories{}, in that order.  It exits
+//! if spec selects nothing.
+//
+inline void FeatureClassPtrs::features_matching(const char* spec) {
+  std::string error;
+  if (!features_matching(spec, error)) {
+    std::cerr << "## Error in FeatureClassPtrs::features_matching(): " << error << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}  // FeatureClassPtrs::features_matching()
+
+
+//! FeatureClassPtrs::features_matching(spec, error) is
+//! features_matching(spec) for callers that mustn't exit: if spec
+//! can't be read or selects no classes it sets error, loads nothing
+//! and returns false.
+//
+inline bool FeatureClassPtrs::features_matching(const char* spec, std::string& error) {
+  std::string text;
+  if (spec[0] == '@') {
+    std::ifstream is(spec+1);
+    if (!is) {
+      error = std::string("can't open ") + (spec+1);
+      return false;
+    }
+    std::string line;
+    while (std::getline(is, line)) 
+      text += line.substr(0, line.find('#')) + '\n';
+  }
+  else
+    text = spec;
+
+  std::vector<std::string> patterns;
+  std::string::size_type start = 0;
+  while ((start = text.find_first_not_of(", \t\n", start)) != std::string::npos) {
+    std::string::size_type end = text.find_first_of(", \t\n", start);
+    patterns.push_back(text.substr(start, end - start));
+    start = end;
+  }
+  if (patterns.empty()) {
+    error = std::string("no patterns in ") + spec;
+    return false;
+  }
+
+  static const bool covered = feature_class_factories::covers_standard_sets();
+  assert(covered);
+  (void) covered;
+
+  const std::vector<std::string>& all = feature_class_factories::identifiers();
+  std::vector<bool> selected(all.size(), patterns[0][0] == '!');
+  cforeach (std::vector<std::string>, it, patterns) {
+    bool deselect = (*it)[0] == '!';
+    const char* pattern = it->c_str() + deselect;
+    bool matched = false;
+    for (size_type i = 0; i < all.size(); ++i)
+      if (fnmatch(pattern, all[i].c_str(), 0) == 0) {
+	selected[i] = !deselect;
+	matched = true;
+      }
+    if (!matched)
+      write_message("## Warning: feature class pattern " + *it 
+		    + " matches no feature class\n");
+  }
+  for (size_type i = 0; i < all.size(); ++i)
+    if (selected[i])
+      push_back(feature_class_factories::make(all[i]));
+  if (empty()) {
+    error = std::string(spec) + " selects no feature classes";
+    return false;
+  }
+  return true;
+}  // FeatureClassPtrs::features_matching()
+
+
+//! FeatureClassPtrs::FeatureClassPtrs() preloads a set of features:
+//! fcname is NULL (the default set), "local", "sp" or "spnn", or else
+//! a feature class spec for features_matching().  It exits if fcname
+//! is a spec that selects nothing.
 //
 inline FeatureClassPtrs::FeatureClassPtrs(const char* fcname) {
+  std::string error;
+  if (!load_features(fcname, error)) {
+    std::cerr << "## Error in FeatureClassPtrs::FeatureClassPtrs(): " << error << std::endl;
+    exit(EXIT_FAILURE);
+  }
+} // FeatureClassPtrs::FeatureClassPtrs()
+
+
+//! FeatureClassPtrs::FeatureClassPtrs(fcname, error) is
+//! FeatureClassPtrs(fcname) for callers that mustn't exit: if fcname
+//! is a bad spec it sets error and loads no feature classes.
+//
+inline FeatureClassPtrs::FeatureClassPtrs(const char* fcname, std::string& error) {
+  load_features(fcname, error);
+} // FeatureClassPtrs::FeatureClassPtrs()
+
+
+//! FeatureClassPtrs::load_features() loads the feature classes fcname
+//! names (see FeatureClassPtrs()), returning false with error set if
+//! it can't
+//
+inline bool FeatureClassPtrs::load_features(const char* fcname, std::string& error) {
   // features_connll();
   if (fcname == NULL)
     features_050902();
@@ -3312,12 +5025,10 @@ inline FeatureClassPtrs::FeatureClassPtrs(const char* fcname) {
     features_spnn(false);
   else if (strcmp(fcname, "spnn") == 0)
     features_spnn(true);
-  else {
-    std::cerr << "## Error in spfeatures.h: FeatureClassPtrs::FeatureClassPtrs(), unknown fcname = "
-	      << fcname << std::endl;
-    exit(EXIT_FAILURE);
-  }
-} // FeatureClassPtrs::FeatureClassPtrs()
+  else
+    return features_matching(fcname, error);
+  return true;
+} // FeatureClassPtrs::load_features()
   
 
 #undef FloatTol
@@ -73,10 +73,7 @@ std::ostream& operator<< (std::ostream& os, const sptree_label& l) {
 typedef tree_node<sptree_label> sptree;
 
 inline symbol downcase(symbol cat) {
-  std::string s(cat.string_reference());
-  for (std::string::iterator it = s.begin(); it != s.end(); ++it)
-    *it = tolower(*it);
-  return symbol(s);
+  return cat.downcase();
 }
 
 //! tree_sptree_helper() is a helper function that actually copies the trees.
@@ -135,7 +132,7 @@ sptree* tree_sptree(const tree_node<label_type>* tp, bool downcase_flag=false)
   return tree_sptree_helper(downcase_flag, tp, NULL, NULL, position);
 }
 
-template <> tree_node<sptree_label>* copy_treeptr(const tree_node<sptree_label>* tp)
+template <> inline tree_node<sptree_label>* copy_treeptr(const tree_node<sptree_label>* tp)
 {
   return tree_sptree(tp);
 }
@@ -13,6 +13,7 @@
 
 #include "sym.h"
 #include <cctype>
+#include <pthread.h>
 
 #define ESCAPE     '\\'
 #define OPENQUOTE  '\"'
@@ -27,16 +28,58 @@ symbol::Table& symbol::table()
   return table_;
 }
 
-symbol::symbol(const std::string& s) : sp(&*(table().insert(s).first)) { };
+// table_lock protects the symbol table.  Looking up a string that is
+// already interned only takes it for reading, so several threads can
+// construct symbols at once; it is taken for writing only to insert
+// a new string or fill in a lower-cased slot.
+//
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
 
-symbol::symbol(const char* cp) { 
-  if (cp) {
-    std::string s(cp); 
-    sp = &*(table().insert(s).first);
-  }
-  else
-    sp = NULL;
-};
+// intern() returns the table's copy of s, inserting it if need be.
+//
+const std::string* symbol::intern(const std::string& s) {
+  pthread_rwlock_rdlock(&table_lock);
+  Table::const_iterator it = table().find(s);
+  const std::string* p = (it == table().end()) ? NULL : &it->first;
+  pthread_rwlock_unlock(&table_lock);
+  if (p != NULL)
+    return p;
+  pthread_rwlock_wrlock(&table_lock);
+  p = &table().insert(Table::value_type(s, NULL)).first->first;
+  pthread_rwlock_unlock(&table_lock);
+  return p;
+}
+
+symbol::symbol(const std::string& s) : sp(intern(s)) { }
+
+symbol::symbol(const char* cp) : sp(cp ? intern(std::string(cp)) : NULL) { }
+
+// downcase() reads the lower-cased slot of this symbol's table entry.
+// sp points to the key of that entry, which is the first member of
+// its Table::value_type.  The slot is filled once, under table_lock,
+// and only ever changes from NULL to its final value, so it can be
+// read without taking the lock.
+//
+symbol symbol::downcase() const {
+  assert(is_defined());
+  Table::value_type& e = const_cast<Table::value_type&>
+    (*reinterpret_cast<const Table::value_type*>(sp));
+  assert(&e.first == sp);
+  const std::string* lower = __atomic_load_n(&e.second, __ATOMIC_ACQUIRE);
+  if (lower != NULL)
+    return symbol(lower);
+
+  std::string s(*sp);
+  for (std::string::iterator si = s.begin(); si != s.end(); ++si)
+    *si = tolower(*si);
+  pthread_rwlock_wrlock(&table_lock);
+  Table::value_type& le = *table().insert(Table::value_type(s, NULL)).first;
+  lower = &le.first;
+  __atomic_store_n(&le.second, lower, __ATOMIC_RELEASE);
+  __atomic_store_n(&e.second, lower, __ATOMIC_RELEASE);
+  pthread_rwlock_unlock(&table_lock);
+  return symbol(lower);
+}
 
 
 // Read/write code
@@ -49,6 +49,8 @@
 //  symbol.string_pointer()
 //  symbol.c_str()
 //  symbol.is_defined()
+//  symbol.downcase()       The symbol with every letter lower-cased
+//  symbol::from_string_pointer(sp)  The symbol whose string_pointer() is sp
 //
 //  std::hash(symbol)
 //
@@ -68,6 +70,7 @@
 #define SYM_H
 
 #include <cassert>
+#include <ext/hash_map>
 #include <ext/hash_set>
 #include <iostream>
 #include <string>
@@ -111,8 +114,14 @@ class symbol {
   const std::string* sp;
   symbol(const std::string* sp_) : sp(sp_) { }
 
-  typedef ext::hash_set<std::string, hashstr> Table;
+  // Table maps each interned string to its lower-cased version, or
+  // NULL until downcase() has been called on it or on a symbol with
+  // the same lower-cased string.  A symbol's sp points to the key of
+  // its Table entry, so downcase() finds the slot without a lookup.
+  //
+  typedef ext::hash_map<std::string, const std::string*, hashstr> Table;
   static Table& table();
+  static const std::string* intern(const std::string& s);
 
 public:
   
@@ -128,7 +137,10 @@ public:
   const std::string* string_pointer() const { return sp; }
   const char* c_str() const { assert(is_defined()); return sp->c_str(); }
 
+  symbol downcase() const;     // memoized, so lock-free after the first call
+
   static symbol undefined() { return symbol(stringptr(NULL)); }
+  static symbol from_string_pointer(const std::string* sp) { return symbol(sp); }
   static size_t size() { return table().size(); }
 
   bool operator== (const symbol s) const { return sp == s.sp; }
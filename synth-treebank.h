@@ -0,0 +1,334 @@
+// synth-treebank.h -- deterministic synthetic n-best treebanks
+//
+// synth_treebank{} generates Penn-treebank style gold trees together
+// with n-best lists of perturbed parses in the formats read by
+// sp_sentence_type::read(), i.e.,
+//
+//   gold file:   <nsentences>
+//                <label> TAB <tree>        (one line per sentence)
+//
+//   n-best file: <nparses> TAB <label>     (per sentence)
+//                <logprob>                 (per parse)
+//                <tree>
+//
+// The trees only use categories known to heads.cc.  Every parse has
+// the same yield as its gold tree; parses are derived from the gold
+// tree by relabelling, flattening and grouping nodes, each node being
+// perturbed with probability perturb_rate.  The output depends only
+// on the parameters (including the seed), so it can be used to
+// produce repeatable benchmarks.
+
+#ifndef SYNTH_TREEBANK_H
+#define SYNTH_TREEBANK_H
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class synth_treebank {
+public:
+
+  // generation parameters
+
+  size_t nsentences;      //!< number of sentences to generate
+  size_t mean_length;     //!< mean sentence length in words
+  size_t nbest;           //!< number of parses per sentence
+  double perturb_rate;    //!< probability of perturbing each node of a parse
+  size_t vocabulary;      //!< number of distinct words per open-class tag
+  unsigned long long seed;
+
+  synth_treebank(size_t nsentences = 1000, size_t mean_length = 20,
+		 size_t nbest = 20, double perturb_rate = 0.1,
+		 size_t vocabulary = 2000, unsigned long long seed = 1)
+    : nsentences(nsentences), mean_length(mean_length), nbest(nbest),
+      perturb_rate(perturb_rate), vocabulary(vocabulary), seed(seed) { }
+
+  //! write() writes the n-best parses to parsefp and the gold trees to goldfp
+  //
+  void write(FILE* parsefp, FILE* goldfp) {
+    state = seed ? seed : 1;
+    fprintf(goldfp, "%u\n", unsigned(nsentences));
+    for (size_t i = 0; i < nsentences; ++i) {
+      size_t length = 2 + random(mean_length) + random(mean_length/2+1);
+      node gold = root(length);
+      std::string goldstr = gold.str();
+      fprintf(goldfp, "s%u\t%s\n", unsigned(i), goldstr.c_str());
+      size_t nparses = nbest > 0 ? 1 + random(nbest) : 1;
+      if (nparses < (nbest+1)/2)   // most sentences have full n-best lists
+	nparses = nbest;
+      size_t goldpos = uniform() < 0.5 ? random(nparses) : nparses;
+      fprintf(parsefp, "%u\ts%u\n", unsigned(nparses), unsigned(i));
+      double logprob = -8.0*length;
+      for (size_t j = 0; j < nparses; ++j) {
+	logprob -= 0.1 + 2*uniform();
+	if (j == goldpos)
+	  fprintf(parsefp, "%f\n%s\n", logprob, goldstr.c_str());
+	else {
+	  node parse = gold;
+	  perturb(parse);
+	  fprintf(parsefp, "%f\n%s\n", logprob, parse.str().c_str());
+	}
+      }
+    }
+  }  // synth_treebank::write()
+
+  //! write() writes the n-best parses and gold trees to the named files,
+  //! returning false if they can't be opened.
+  //
+  bool write(const char* parsefile, const char* goldfile) {
+    FILE* parsefp = fopen(parsefile, "w");
+    if (parsefp == NULL)
+      return false;
+    FILE* goldfp = fopen(goldfile, "w");
+    if (goldfp == NULL) {
+      fclose(parsefp);
+      return false;
+    }
+    write(parsefp, goldfp);
+    bool goldok = fclose(goldfp) == 0;
+    return fclose(parsefp) == 0 && goldok;
+  }  // synth_treebank::write()
+
+private:
+
+  //! node{} is a tree node; preterminals have a word and no children
+  //
+  struct node {
+    std::string cat;
+    std::string word;
+    std::vector<node> children;
+
+    node(const std::string& cat = "", const std::string& word = "")
+      : cat(cat), word(word) { }
+
+    bool preterminal() const { return children.empty(); }
+
+    void str(std::string& s) const {
+      s += '(';
+      s += cat;
+      if (preterminal()) {
+	s += ' ';
+	s += word;
+      }
+      else
+	for (size_t i = 0; i < children.size(); ++i) {
+	  s += ' ';
+	  children[i].str(s);
+	}
+      s += ')';
+    }  // synth_treebank::node::str()
+
+    std::string str() const { std::string s; str(s); return s; }
+  };  // synth_treebank::node{}
+
+  unsigned long long state;
+
+  //! next() is the xorshift64* generator
+  //
+  unsigned long long next() {
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+  }  // synth_treebank::next()
+
+  //! uniform() returns a double in [0,1)
+  //
+  double uniform() { return (next() >> 11) * (1.0/9007199254740992.0); }
+
+  //! random() returns an integer in [0,n)
+  //
+  size_t random(size_t n) { return n > 0 ? size_t(uniform()*n) : 0; }
+
+  const char* choose(const char* const* xs, size_t n) { return xs[random(n)]; }
+
+  //! word() returns a word for tag; open-class words are drawn from
+  //! a roughly Zipfian distribution over the vocabulary.
+  //
+  node word(const char* tag) {
+    static const char* const dts[] = { "the", "a", "this", "some", "every" };
+    static const char* const ins[] = { "of", "in", "on", "with", "for", "at", "from" };
+    static const char* const ccs[] = { "and", "or", "but" };
+    static const char* const mds[] = { "will", "can", "may", "should" };
+    static const char* const prps[] = { "he", "she", "it", "they", "we" };
+    std::string t(tag), w;
+    if (t == "DT") w = choose(dts, 5);
+    else if (t == "IN") w = choose(ins, 7);
+    else if (t == "CC") w = choose(ccs, 3);
+    else if (t == "MD") w = choose(mds, 4);
+    else if (t == "PRP") w = choose(prps, 5);
+    else if (t == ".") w = ".";
+    else {
+      size_t i = size_t(pow(double(vocabulary), uniform()));
+      char buf[32];
+      sprintf(buf, "%u", unsigned(i));
+      for (size_t k = 0; k < t.size(); ++k)
+	w += tolower(t[k]);
+      w += buf;
+    }
+    return node(t, w);
+  }  // synth_treebank::word()
+
+  node root(size_t length) {
+    node s1("S1");
+    node s = S(length > 1 ? length-1 : 1);
+    s.children.push_back(word("."));
+    s1.children.push_back(s);
+    return s1;
+  }  // synth_treebank::root()
+
+  // The following functions generate a phrase of category XP whose yield is b words
+
+  node S(size_t b) {
+    node n("S");
+    if (b >= 4 && uniform() < 0.15) {
+      n.children.push_back(ADVP(1));
+      --b;
+    }
+    if (b < 2) {
+      n.children.push_back(VP(b));
+      return n;
+    }
+    size_t k = 1 + random(b/2);
+    n.children.push_back(NP(k));
+    n.children.push_back(VP(b-k));
+    return n;
+  }  // synth_treebank::S()
+
+  node NP(size_t b) {
+    static const char* const ns[] = { "PRP", "NN", "NNS", "NNP" };
+    node n("NP");
+    double r = uniform();
+    if (b <= 1)
+      n.children.push_back(word(choose(ns, 4)));
+    else if (b >= 4 && r < 0.45) {
+      size_t k = 2 + random(b-3);
+      n.children.push_back(NP(k));
+      n.children.push_back(PP(b-k));
+    }
+    else if (b >= 3 && r < 0.6) {
+      size_t k = 1 + random(b-2);
+      n.children.push_back(NP(k));
+      n.children.push_back(word("CC"));
+      n.children.push_back(NP(b-k-1));
+    }
+    else if (r < 0.7) {
+      for (size_t i = 0; i < b; ++i)
+	n.children.push_back(word("NNP"));
+    }
+    else {
+      n.children.push_back(word(uniform() < 0.8 ? "DT" : "CD"));
+      for (size_t i = 2; i < b; ++i)
+	n.children.push_back(word("JJ"));
+      n.children.push_back(word(uniform() < 0.7 ? "NN" : "NNS"));
+    }
+    return n;
+  }  // synth_treebank::NP()
+
+  node VP(size_t b) {
+    static const char* const vs[] = { "VBD", "VBZ", "VBP", "VB", "VBN", "VBG" };
+    node n("VP");
+    double r = uniform();
+    if (b >= 2 && r < 0.15) {
+      n.children.push_back(word("MD"));
+      n.children.push_back(VP(b-1));
+      return n;
+    }
+    n.children.push_back(word(choose(vs, 6)));
+    if (b <= 1)
+      return n;
+    if (b >= 4 && r < 0.45) {
+      size_t k = 1 + random(b-3);
+      n.children.push_back(NP(k));
+      n.children.push_back(PP(b-1-k));
+    }
+    else if (b >= 4 && r < 0.6)
+      n.children.push_back(SBAR(b-1));
+    else if (b <= 3 && r < 0.6)
+      n.children.push_back(ADVP(b-1));
+    else if (r < 0.7)
+      n.children.push_back(ADJP(b-1));
+    else
+      n.children.push_back(NP(b-1));
+    return n;
+  }  // synth_treebank::VP()
+
+  node PP(size_t b) {
+    node n("PP");
+    n.children.push_back(word("IN"));
+    n.children.push_back(NP(b > 1 ? b-1 : 1));
+    return n;
+  }  // synth_treebank::PP()
+
+  node SBAR(size_t b) {
+    node n("SBAR");
+    n.children.push_back(word("IN"));
+    n.children.push_back(S(b > 1 ? b-1 : 1));
+    return n;
+  }  // synth_treebank::SBAR()
+
+  node ADJP(size_t b) {
+    node n("ADJP");
+    if (b >= 3) {
+      n.children.push_back(word("JJ"));
+      n.children.push_back(PP(b-1));
+    }
+    else {
+      if (b == 2)
+	n.children.push_back(word("RB"));
+      n.children.push_back(word("JJ"));
+    }
+    return n;
+  }  // synth_treebank::ADJP()
+
+  node ADVP(size_t b) {
+    node n("ADVP");
+    for (size_t i = 0; i < b; ++i)
+      n.children.push_back(word("RB"));
+    return n;
+  }  // synth_treebank::ADVP()
+
+  //! perturb() perturbs the children of n (but not n itself), keeping
+  //! the yield of n unchanged.
+  //
+  void perturb(node& n) {
+    static const char* const cats[] = { "NP", "VP", "PP", "S", "SBAR", "ADJP",
+					"ADVP", "FRAG", "UCP", "PRN", "QP", "X" };
+    static const char* const tags[] = { "NN", "NNS", "NNP", "JJ", "VBD", "VBN",
+					"VB", "VBZ", "IN", "RB", "RP", "CD" };
+    for (size_t i = 0; i < n.children.size(); ++i) {
+      node& c = n.children[i];
+      if (c.preterminal()) {
+	if (c.cat != "." && uniform() < perturb_rate/2)
+	  c.cat = choose(tags, 12);
+	continue;
+      }
+      perturb(c);
+      if (uniform() >= perturb_rate)
+	continue;
+      double r = uniform();
+      if (r < 0.4)                                         // relabel
+	c.cat = choose(cats, 12);
+      else if (r < 0.7 || n.children.size() < 3) {         // flatten
+	std::vector<node> gcs;
+	gcs.swap(c.children);
+	n.children.erase(n.children.begin()+i);
+	n.children.insert(n.children.begin()+i, gcs.begin(), gcs.end());
+	i += gcs.size()-1;
+      }
+      else {                                               // group
+	size_t j = (i+1 < n.children.size()) ? i : i-1;
+	node g(choose(cats, 12));
+	g.children.push_back(n.children[j]);
+	g.children.push_back(n.children[j+1]);
+	n.children.erase(n.children.begin()+j, n.children.begin()+j+2);
+	n.children.insert(n.children.begin()+j, g);
+	i = j;
+      }
+    }
+  }  // synth_treebank::perturb()
+
+};  // synth_treebank{}
+
+#endif // SYNTH_TREEBANK_H
@@ -0,0 +1,247 @@
+// thread-pool.h -- a fixed-size pool of work-stealing worker threads
+//
+// thread_pool{} runs thread_pool::task{}s on a fixed number of
+// pthreads.  Tasks submitted from outside the pool are run in the
+// order they are submitted (but may finish in any order); wait()
+// blocks until every submitted task has finished.  The pool doesn't
+// own its tasks.
+//
+//   thread_pool pool(nthreads);
+//   pool.submit(&task1);
+//   pool.submit(&task2);
+//   pool.wait();
+//
+// A task running on the pool can also fork subtasks into a
+// thread_pool::group{} and join them with wait(group).  Each worker
+// keeps the tasks it forks in a deque of its own and runs them newest
+// first, while idle workers steal the oldest tasks from the other
+// workers' deques.  So a task that forks its subtasks largest first
+// has the largest ones stolen early, and the small ones left to run
+// last on the worker that forked them, which keeps the tail short.
+// A worker waiting for a group runs deque tasks in the meantime, so
+// forking and joining never ties up a thread.
+//
+//   thread_pool::group g;
+//   pool.submit(&subtask1, g);
+//   pool.submit(&subtask2, g);
+//   pool.wait(g);
+//
+// The deques are all guarded by the pool's mutex: tasks take at least
+// tens of microseconds, so the lock is rarely contended.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <cassert>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <pthread.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+class thread_pool {
+public:
+
+  //! task{} is an ABC for the work units run by a thread_pool
+  //
+  struct task {
+    virtual ~task() { }
+    virtual void run() = 0;
+  };  // thread_pool::task{}
+
+  //! group{} counts the unfinished tasks submitted with it; it must
+  //! outlive them
+  //
+  struct group {
+    size_t nunfinished;
+    group() : nunfinished(0) { }
+  };  // thread_pool::group{}
+
+  //! default_nthreads() returns the number of online processors
+  //
+  static size_t default_nthreads() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+  }  // thread_pool::default_nthreads()
+
+  thread_pool(size_t nthreads = default_nthreads())
+    : nunfinished(0), stopping(false) {
+    pthread_mutex_init(&mutex, NULL);
+    pthread_cond_init(&changed, NULL);
+    threads.resize(nthreads > 0 ? nthreads : 1);
+    deques.resize(threads.size());
+    workers.resize(threads.size());
+    for (size_t i = 0; i < threads.size(); ++i) {
+      workers[i].pool = this;
+      workers[i].index = i;
+      if (pthread_create(&threads[i], NULL, &thread_pool::worker, &workers[i]) != 0) {
+	std::cerr << "## Error in thread_pool: can't create thread " << i << std::endl;
+	exit(EXIT_FAILURE);
+      }
+    }
+  }  // thread_pool::thread_pool()
+
+  ~thread_pool() {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+    for (size_t i = 0; i < threads.size(); ++i)
+      pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&changed);
+    pthread_mutex_destroy(&mutex);
+  }  // thread_pool::~thread_pool()
+
+  size_t nthreads() const { return threads.size(); }
+
+  //! submit() queues t to be run by a worker thread.  If it is called
+  //! by a task running on this pool, t goes on that worker's deque.
+  //
+  void submit(task* t) { submit(t, NULL); }
+
+  //! submit(t, g) is submit(t), but also adds t to g
+  //
+  void submit(task* t, group& g) { submit(t, &g); }
+
+  //! wait() blocks until all submitted tasks have finished.  It must
+  //! not be called by a task running on this pool.
+  //
+  void wait() {
+    pthread_mutex_lock(&mutex);
+    assert(current() == NULL || current()->pool != this);
+    while (nunfinished > 0)
+      pthread_cond_wait(&changed, &mutex);
+    pthread_mutex_unlock(&mutex);
+  }  // thread_pool::wait()
+
+  //! wait(g) blocks until all of g's tasks have finished.  A task
+  //! running on this pool runs deque tasks (its own first) meanwhile.
+  //
+  void wait(group& g) {
+    pthread_mutex_lock(&mutex);
+    const worker_id* w = current();
+    if (w != NULL && w->pool == this) {
+      entry e;
+      while (g.nunfinished > 0)
+	if (take(w->index, true, e))
+	  run(e);
+	else
+	  pthread_cond_wait(&changed, &mutex);
+    }
+    else
+      while (g.nunfinished > 0)
+	pthread_cond_wait(&changed, &mutex);
+    pthread_mutex_unlock(&mutex);
+  }  // thread_pool::wait()
+
+private:
+
+  typedef std::vector<pthread_t> pthreads;
+  typedef std::pair<task*,group*> entry;
+  typedef std::deque<entry> entries;
+
+  //! worker_id{} identifies a worker thread to the tasks it runs
+  //
+  struct worker_id {
+    thread_pool* pool;
+    size_t index;
+  };  // thread_pool::worker_id{}
+
+  pthreads threads;
+  std::vector<worker_id> workers;
+  entries injected;              //!< tasks submitted from outside the pool
+  std::vector<entries> deques;   //!< the tasks each worker has forked
+  size_t nunfinished;            //!< tasks submitted but not yet finished
+  bool stopping;
+  pthread_mutex_t mutex;
+  pthread_cond_t changed;        //!< broadcast when tasks are queued or finish
+
+  thread_pool(const thread_pool&);             // not copyable
+  thread_pool& operator= (const thread_pool&);
+
+  //! current() is the calling thread's worker_id, or NULL if it isn't
+  //! a worker
+  //
+  static const worker_id*& current() {
+    static __thread const worker_id* w = NULL;
+    return w;
+  }  // thread_pool::current()
+
+  void submit(task* t, group* g) {
+    pthread_mutex_lock(&mutex);
+    const worker_id* w = current();
+    if (w != NULL && w->pool == this)
+      deques[w->index].push_back(entry(t, g));
+    else
+      injected.push_back(entry(t, g));
+    ++nunfinished;
+    if (g != NULL)
+      ++g->nunfinished;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&mutex);
+  }  // thread_pool::submit()
+
+  //! take() removes the next task for worker i to run from the queues:
+  //! the newest task on its own deque, else the oldest task submitted
+  //! from outside (unless it is helping, i.e., waiting for a group, as
+  //! such a task could take arbitrarily long), else the oldest task on
+  //! another worker's deque.  The mutex must be held.
+  //
+  bool take(size_t i, bool helping, entry& e) {
+    if (!deques[i].empty()) {
+      e = deques[i].back();
+      deques[i].pop_back();
+      return true;
+    }
+    if (!helping && !injected.empty()) {
+      e = injected.front();
+      injected.pop_front();
+      return true;
+    }
+    for (size_t j = 1; j < deques.size(); ++j) {
+      entries& victim = deques[(i + j) % deques.size()];
+      if (!victim.empty()) {
+	e = victim.front();
+	victim.pop_front();
+	return true;
+      }
+    }
+    return false;
+  }  // thread_pool::take()
+
+  //! run() runs e's task without the mutex, which must be held
+  //
+  void run(entry& e) {
+    pthread_mutex_unlock(&mutex);
+    e.first->run();
+    pthread_mutex_lock(&mutex);
+    assert(nunfinished > 0);
+    bool done = --nunfinished == 0;
+    if (e.second != NULL && --e.second->nunfinished == 0)
+      done = true;
+    if (done)
+      pthread_cond_broadcast(&changed);
+  }  // thread_pool::run()
+
+  static void* worker(void* arg) {
+    const worker_id* w = static_cast<const worker_id*>(arg);
+    thread_pool& pool = *w->pool;
+    current() = w;
+    pthread_mutex_lock(&pool.mutex);
+    entry e;
+    while (true)
+      if (pool.take(w->index, false, e))
+	pool.run(e);
+      else if (pool.stopping)
+	break;
+      else
+	pthread_cond_wait(&pool.changed, &pool.mutex);
+    pthread_mutex_unlock(&pool.mutex);
+    return NULL;
+  }  // thread_pool::worker()
+
+};  // thread_pool{}
+
+#endif // THREAD_POOL_H
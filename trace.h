@@ -0,0 +1,197 @@
+// trace.h -- timeline tracing in Chrome trace-event format
+//
+// The tracer records spans of time spent in the stages of feature
+// extraction (reading, readtree, tree_sptree, precrec, per-feature-class
+// work, pruning and output) and writes them as Chrome/Perfetto
+// trace-event JSON, which can be loaded into chrome://tracing or
+// ui.perfetto.dev.
+//
+// tracer::enable()    turns tracing on, sampling every n'th sentence
+// tracer::sentence()  marks the start of sentence i on this thread
+// trace_span{}        records the lifetime of a scope as a span
+// tracer::write()     writes the recorded spans to a JSON file
+//
+// Spans are only recorded for sampled sentences, except spans
+// constructed with always=true (e.g., pruning), which are recorded
+// whenever tracing is on.  When tracing is off a trace_span costs
+// a thread-local flag test.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdio>
+#include <pthread.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "profile.h"
+
+class tracer {
+public:
+
+  //! trace_event{} is a single complete ("X") trace event.
+  //
+  struct trace_event {
+    std::string name;
+    const char* cat;
+    double ts;       //!< start time in seconds since tracing was enabled
+    double dur;      //!< duration in seconds
+    int tid;
+    long sentence;   //!< sentence index, or -1 if not in a sentence
+  };  // tracer::trace_event{}
+
+  typedef std::vector<trace_event> trace_events;
+
+  //! enabled() is true if tracing is turned on
+  //
+  static bool& enabled() { static bool e = false; return e; }
+
+  //! active() is true if the current thread is in a sampled sentence
+  //
+  static bool& active() { static __thread bool a = false; return a; }
+
+  //! enable() turns on tracing of every n'th sentence
+  //
+  static void enable(size_t n = 1) {
+    every() = n > 0 ? n : 1;
+    start_time() = wall_time();
+    enabled() = true;
+  }  // tracer::enable()
+
+  //! sentence() marks the start of sentence i on the calling thread
+  //
+  static void sentence(size_t i) {
+    current_sentence() = i;
+    active() = enabled() && i % every() == 0;
+  }  // tracer::sentence()
+
+  //! current_sentence() is the index of the calling thread's current
+  //! sentence, or -1 if it isn't in one
+  //
+  static long& current_sentence() { static __thread long i = -1; return i; }
+
+  //! end_sentence() marks the end of the current sentence on this thread
+  //
+  static void end_sentence() {
+    current_sentence() = -1;
+    active() = false;
+  }  // tracer::end_sentence()
+
+  //! record() adds a span to the trace
+  //
+  static void record(const char* name, const char* cat, double wall0, double wall1) {
+    trace_event e;
+    e.name = name;
+    e.cat = cat;
+    e.ts = wall0 - start_time();
+    e.dur = wall1 - wall0;
+    e.tid = thread_id();
+    e.sentence = current_sentence();
+    pthread_mutex_lock(&mutex());
+    events().push_back(e);
+    pthread_mutex_unlock(&mutex());
+  }  // tracer::record()
+
+  //! write() writes the trace to filename, returning false on failure
+  //
+  static bool write(const char* filename) {
+    FILE* fp = fopen(filename, "w");
+    if (fp == NULL)
+      return false;
+    int pid = getpid();
+    fprintf(fp, "{\"traceEvents\":[\n");
+    pthread_mutex_lock(&mutex());
+    for (size_t i = 0; i < events().size(); ++i) {
+      const trace_event& e = events()[i];
+      fprintf(fp, "%s{\"name\":\"", i ? ",\n" : "");
+      write_escaped(fp, e.name);
+      fprintf(fp, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+	      "\"pid\":%d,\"tid\":%d", e.cat, 1e6*e.ts, 1e6*e.dur, pid, e.tid);
+      if (e.sentence >= 0)
+	fprintf(fp, ",\"args\":{\"sentence\":%ld}", e.sentence);
+      fprintf(fp, "}");
+    }
+    pthread_mutex_unlock(&mutex());
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(fp) == 0;
+  }  // tracer::write()
+
+private:
+
+  static size_t& every() { static size_t n = 1; return n; }
+  static double& start_time() { static double t = 0; return t; }
+  static trace_events& events() { static trace_events es; return es; }
+
+  static pthread_mutex_t& mutex() {
+    static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    return m;
+  }  // tracer::mutex()
+
+  //! thread_id() returns a small integer identifying the calling thread
+  //
+  static int thread_id() {
+    static int nthreads = 0;
+    static __thread int tid = 0;
+    if (tid == 0)
+      tid = __sync_add_and_fetch(&nthreads, 1);
+    return tid;
+  }  // tracer::thread_id()
+
+  static void write_escaped(FILE* fp, const std::string& s) {
+    for (size_t i = 0; i < s.size(); ++i) {
+      char c = s[i];
+      if (c == '"' || c == '\\')
+	putc('\\', fp);
+      if (c >= 0 && c < ' ')
+	fprintf(fp, "\\u%04x", c);
+      else
+	putc(c, fp);
+    }
+  }  // tracer::write_escaped()
+
+};  // tracer{}
+
+//! trace_span{} records a span from its construction to its destruction
+//! if the current sentence is being traced (or always is true and
+//! tracing is on).  name must remain valid until the span is destroyed.
+//
+struct trace_span {
+  const char* name;
+  const char* cat;
+  bool on;
+  double wall0;
+
+  trace_span(const char* name, const char* cat = "", bool always = false)
+    : name(name), cat(cat), on(tracer::active() || (always && tracer::enabled())) {
+    if (on)
+      wall0 = wall_time();
+  }
+
+  ~trace_span() {
+    if (on)
+      tracer::record(name, cat, wall0, wall_time());
+  }
+};  // trace_span{}
+
+//! trace_sentence{} marks the calling thread as being in sentence i
+//! from its construction to its destruction, and then restores the
+//! thread's previous sentence (a thread_pool worker waiting for its
+//! own sentence's subtasks may run another sentence's task).
+//
+struct trace_sentence {
+  long previous;
+
+  trace_sentence(size_t i) : previous(tracer::current_sentence()) {
+    tracer::sentence(i);
+  }
+
+  ~trace_sentence() {
+    if (previous >= 0)
+      tracer::sentence(previous);
+    else
+      tracer::end_sentence();
+  }
+};  // trace_sentence{}
+
+#endif // TRACE_H
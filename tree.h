@@ -102,6 +102,7 @@
 // readtree_filename
 // readtree_root()
 // readtree()
+// try_readtree()
 //
 // read_filenamefile_trees()
 // map_filenamefile_trees()
@@ -126,6 +127,7 @@
 #ifndef TREE_H
 #define TREE_H
 
+#include "alloc-tracker.h"
 #include "sym.h"
 #include "symset.h"
 #include "utility.h"
@@ -139,6 +141,7 @@
 #include <iostream>
 #include <memory>
 #include <numeric>
+#include <pthread.h>
 #include <set>
 #include <sstream>
 #include <string>
@@ -352,11 +355,11 @@ public:
   //
   bool operator== (const tree_node& t) const {
     if (this == &t) return true;
-    if (label != t.label) return false;
-    return (child == t->child 
-	    || (child != NULL && t->child != NULL && *child == *t->child))
-      && (next == t->next
-	  || (next != NULL && t->next != NULL && *next == *t->next));
+    if (!(label == t.label)) return false;
+    return (child == t.child 
+	    || (child != NULL && t.child != NULL && *child == *t.child))
+      && (next == t.next
+	  || (next != NULL && t.next != NULL && *next == *t.next));
   }  // tree_node::operator==()
 
   //! < looks at the entire tree, not just this node.
@@ -384,8 +387,9 @@ private:
     tree_node* freelist;
     tree_node* freeblock;
     unsigned int freeblockindex;
+    cache* nextspare;   //!< next cache on the spare list
 
-    cache() : freelist(NULL), freeblock(NULL), freeblockindex(0) {}
+    cache() : freelist(NULL), freeblock(NULL), freeblockindex(0), nextspare(NULL) {}
 
     inline tree_node* alloc() {
       if (freelist) {
@@ -405,17 +409,81 @@ private:
       tp->next = freelist;
       freelist = tp;
     }
+
+    //! acquire() returns a spare cache (or a new one if there are
+    //! none) for the calling thread, and arranges for release() to be
+    //! called with it when the thread exits.
+    //
+    static cache* acquire() {
+      static pthread_once_t once = PTHREAD_ONCE_INIT;
+      pthread_once(&once, &create_key);
+      pthread_mutex_lock(&spare_mutex());
+      cache* c = spare();
+      if (c != NULL)
+	spare() = c->nextspare;
+      else
+	c = new cache;
+      pthread_mutex_unlock(&spare_mutex());
+      pthread_setspecific(key(), c);
+      return c;
+    }  // tree_node::cache::acquire()
+
+    //! release() puts an exiting thread's cache on the spare list.
+    //! Its nodes can't be freed, as nodes move between threads' caches
+    //! when a tree built on one thread is deleted on another.
+    //
+    static void release(void* p) {
+      cache* c = static_cast<cache*>(p);
+      if (current() == c)
+	current() = NULL;
+      pthread_mutex_lock(&spare_mutex());
+      c->nextspare = spare();
+      spare() = c;
+      pthread_mutex_unlock(&spare_mutex());
+    }  // tree_node::cache::release()
+
+    static void create_key() { pthread_key_create(&key(), &release); }
+
+    static pthread_key_t& key() {
+      static pthread_key_t k;
+      return k;
+    }
+
+    static cache*& spare() {
+      static cache* s = NULL;
+      return s;
+    }
+
+    static pthread_mutex_t& spare_mutex() {
+      static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+      return m;
+    }
+
+    //! current() is the calling thread's cache, or NULL
+    //
+    static cache*& current() {
+      static __thread cache* c = NULL;
+      return c;
+    }
   };  // tree_node::cache{}
     
+  //! getcache() returns this thread's cache, so threads can allocate
+  //! and free tree nodes without locking.  A thread's cache is reused
+  //! by a later thread once it exits, so creating and destroying
+  //! thread pools doesn't leak caches.
+  //
   inline static cache& getcache() {
-    static cache c;
-    return c;
+    cache*& c = cache::current();
+    if (c == NULL)
+      c = cache::acquire();
+    return *c;
   }  // tree_node::getcache()
 
 public:
 
   inline void* operator new (size_t size) {
     assert(size == sizeof(tree_node));
+    alloc_tracker::count_node();
     return (void *) getcache().alloc();
   }  // tree_node::operator new()
 
@@ -572,7 +640,7 @@ private:
     ++n;
     if (child)
       n = child->size_helper(n);
-    return next ? next->size_(n) : n;
+    return next ? next->size_helper(n) : n;
   }
 
 public:
@@ -1025,10 +1093,13 @@ tree* readtree_root(FILE* fp, bool downcase_flag = false);
 //! don't hallucinate a ROOT node label, needed for BLLIP trees
 tree* readtree(FILE* fp, bool downcase_flag = false);
 
-//! read a tree from a C string
+//! read a tree from a C string (these may be called from several threads)
 tree* readtree_root(const char* str, bool downcase_flag = false);
-//! read a tree from a C string
+//! read a tree from a C string (these may be called from several threads)
 tree* readtree(const char* str, bool downcase_flag = false);
+//! read a tree from a C string like readtree(), but return NULL rather
+//! than exiting if str isn't a complete tree
+tree* try_readtree(const char* str, bool downcase_flag = false);
 
 template <typename TreePtrs>
 void read_filenamefile_trees(const char* filenamefile, TreePtrs& trees, 
@@ -1332,28 +1403,39 @@ struct precrec_type {
     return (ngold + ntest - 2.0*ncommon) / ngold;
   } // precrec_type::error_rate()
 
-  typedef std::pair<unsigned int,unsigned int> II;
-  typedef std::pair<II,symbol> IIS;
+  //! edge{} is a labelled span.  left and right are packed into a
+  //! single word, and the label is identified by its (unique) symbol,
+  //! so comparing two edges takes at most two integer comparisons.
+  //
+  struct edge {
+    unsigned int span;   // left << 16 | right
+    symbol label;
 
-  struct edge : public IIS {
-    edge(unsigned int left, unsigned int right, symbol cat) : IIS(II(left,right),cat) { }
+    edge(unsigned int left, unsigned int right, symbol cat) 
+      : span(left << 16 | right), label(cat) { 
+      assert(left < 65536 && right < 65536);
+    }
 
-    unsigned int left() const { return first.first; }
-    unsigned int right() const { return first.second; }
-    symbol cat() const { return second; }
-  };
+    unsigned int left() const { return span >> 16; }
+    unsigned int right() const { return span & 0xffff; }
+    symbol cat() const { return label; }
 
-  struct edges : public std::map<edge, unsigned int> {
+    bool operator== (const edge& e) const { return span == e.span && label == e.label; }
+    bool operator!= (const edge& e) const { return !(*this == e); }
+    bool operator< (const edge& e) const { 
+      return span < e.span || (span == e.span && label < e.label);
+    }
+  };  // precrec_type::edge{}
+
+  //! edges{} is a bag of edges, kept as a sorted vector (so an edge
+  //! that occurs twice appears twice).
+  //
+  struct edges : public std::vector<edge> {
     edges() { }
     template <typename Tree>
     edges(const Tree* t) { tree_nontermedges(t, *this); }
 
-    unsigned int nedges() const {
-      unsigned int n = 0;
-      for (const_iterator it = begin(); it != end(); ++it)
-	n += it->second;
-      return n;
-    }  // precrec_type::edges::nedges()
+    unsigned int nedges() const { return size(); }
 
   };  // precrec_type::edges{}
 
@@ -1365,13 +1447,23 @@ struct precrec_type {
     return cat == prt ? advp : cat;
   }
 
-  //! tree_nontermedges() maps a tree to its nonterminal edges, ignoring punctuation
+  //! tree_nontermedges() adds a tree's nonterminal edges to es, ignoring punctuation
   //! and empty nodes as described in the EVALB documentation.
   //
   template <typename Tree>
-  static unsigned int tree_nontermedges(const Tree* t, edges& es, 
-					unsigned int left = 0, 
-					bool nonrootnode = false) {
+  static unsigned int tree_nontermedges(const Tree* t, edges& es) {
+    size_t n0 = es.size();
+    unsigned int right = tree_nontermedges_helper(t, es, 0, false);
+    std::sort(es.begin()+n0, es.end());
+    std::inplace_merge(es.begin(), es.begin()+n0, es.end());
+    return right;
+  }  // precrec_type::tree_nontermedges()
+
+  //! tree_nontermedges_helper() appends the edges of t, which starts at left, to es
+  //
+  template <typename Tree>
+  static unsigned int tree_nontermedges_helper(const Tree* t, edges& es, 
+					       unsigned int left, bool nonrootnode) {
 
     static const tree_label::catset_type punctuation(", : `` '' .");
 
@@ -1386,32 +1478,31 @@ struct precrec_type {
   
     unsigned int right = left;
     for (const Tree* c = t->child; c; c = c->next) 
-      right = tree_nontermedges(c, es, right, true);
+      right = tree_nontermedges_helper(c, es, right, true);
 
     if (nonrootnode && right > left)      // ignore root node and empty nodes
-      ++es[edge(left, right, relabel_category(t->label.cat))];
+      es.push_back(edge(left, right, relabel_category(t->label.cat)));
     
     return right;
-  }  // precrec_type::tree_nontermedges()
+  }  // precrec_type::tree_nontermedges_helper()
 
   // operator() scores two sets of edges and accumulates the scores.
+  // Both are sorted, so this is a merge.
   //
   precrec_type& operator()(const edges& goldedges, const edges& testedges) {
     edges::const_iterator git = goldedges.begin(), tit = testedges.begin();
     while (git != goldedges.end() && tit != testedges.end()) 
-      if (git->first == tit->first) { // gold and test edges match
-	ncommon += std::min(git->second, tit->second);
-	ngold += git++->second;      
-	ntest += tit++->second;
+      if (*git == *tit) {             // gold and test edges match
+	++ncommon;
+	++git;
+	++tit;
       }
-      else if (git->first < tit->first) 
-	ngold += git++->second;
+      else if (*git < *tit) 
+	++git;
       else 
-	ntest += tit++->second;
-    while (git != goldedges.end()) 
-      ngold += git++->second;
-    while (tit != testedges.end()) 
-      ntest += tit++->second;
+	++tit;
+    ngold += goldedges.size();
+    ntest += testedges.size();
     return *this;
   }  // precrec_type::operator()
 
@@ -37,6 +37,8 @@
 #include <cassert>
 #include <cctype>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ext/hash_map>
 #include <ext/hash_set>
 #include <ext/slist>
@@ -49,6 +51,7 @@
 #include <string>
 #include <utility>
 #include <vector>
+#include <sys/resource.h>
 
 #if (__GNUC__ > 3) || (__GNUC__ >= 3 && __GNUC_MINOR__ >= 1)
 #define EXT_NAMESPACE __gnu_cxx
@@ -867,33 +870,39 @@ inline std::ostream& operator<< (std::ostream& os, const boost::shared_ptr<T>& s
 
 #endif  // BOOST_SHARED_PTR_HPP_INCLUDED
 
+//! resource_usage{} writes the user and system time used so far,
+//! and the current and peak resident set size, when inserted into
+//! a stream.  The RSS figures come from /proc/self/status where it
+//! exists, otherwise the peak is taken from getrusage().
+//
 struct resource_usage { };
 
 inline std::ostream& operator<< (std::ostream& os, resource_usage r)
 {
-  /* Mac OS X does not have /proc, but anyway we don't need this
-   * output for feature extraction, so I'm disabling it. (Matt Post)
-   */
-  return os;
-
-  /*
-  FILE* fp = fopen("/proc/self/stat", "r");
-  assert(fp);
-  int utime;
-  int stime;
-  unsigned int vsize;
-  unsigned int rss;
-  int result = 
-    fscanf(fp, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %d %d %*d %*d %*d %*d"
-           "%*u %*u %*d %u %u", &utime, &stime, &vsize, &rss);
-  assert(result == 4);
-  fclose(fp);
-  // s << "utime = " << utime << ", stime = " << stime << ", vsize = " << vsize << ", rss = " << rss
-;
-  // return s << "utime = " << utime << ", vsize = " << vsize;
-  return os << "utime " << float(utime)/1.0e2 << "s, vsize " 
-	    << float(vsize)/1048576.0 << " Mb.";
-  */
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0)
+    return os;
+  double utime = ru.ru_utime.tv_sec + 1e-6*ru.ru_utime.tv_usec;
+  double stime = ru.ru_stime.tv_sec + 1e-6*ru.ru_stime.tv_usec;
+#ifdef __APPLE__
+  long rss_kb = -1, peak_kb = ru.ru_maxrss/1024;   // ru_maxrss is in bytes
+#else
+  long rss_kb = -1, peak_kb = ru.ru_maxrss;        // ru_maxrss is in Kb
+#endif
+  if (FILE* fp = fopen("/proc/self/status", "r")) {
+    char line[256];
+    while (fgets(line, sizeof(line), fp)) {
+      if (!strncmp(line, "VmRSS:", 6))
+	rss_kb = atol(line+6);
+      else if (!strncmp(line, "VmHWM:", 6))
+	peak_kb = atol(line+6);
+    }
+    fclose(fp);
+  }
+  os << "utime " << utime << "s, stime " << stime << "s";
+  if (rss_kb >= 0)
+    os << ", rss " << rss_kb/1024.0 << " Mb";
+  return os << ", peak rss " << peak_kb/1024.0 << " Mb.";
 }
 
 #endif  // UTILITY_H